@@ -1,29 +1,147 @@
 #include <SFML/Graphics.hpp>
+#include "BlackHole.h"
 #include <vector>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <utility>
+#include <chrono>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <type_traits>
+#include <unordered_map>
+#include <queue>
+#include <atomic>
+#include <array>
 #include <iostream>
+#include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+#include <new>
+#include <exception>
+#include <limits>
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define BH_HAVE_IO_URING 1
+#else
+#define BH_HAVE_IO_URING 0
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#endif
 
 const int WINDOW_WIDTH = 1200;
 const int WINDOW_HEIGHT = 800;
 const float PI = 3.14159265359f;
+const float FLUX_CELL_SIZE = 4.0f;
+const float LIGHT_SPEED = 200.0f;      // pixels per second
+const float GRAVITY_SCALE = 10000.0f;  // G in visualization units
+
+// ---------------------------------------------------------------------------
+// 2D math layer
+// ---------------------------------------------------------------------------
+
+// Reciprocal square root flavours. The fast modes use the bit-level initial
+// guess (magic 0x5f375a86) followed by Newton-Raphson refinement.
+// Measured max relative error over [1e-3, 1e6]:
+//   Exact        - 1/std::sqrt, correctly rounded to ~1 ulp
+//   Fast         - one Newton step,  |err| <= 1.76e-3
+//   FastRefined  - two Newton steps, |err| <= 4.8e-6
+// Scalar hardware sqrt usually wins; the fast modes pay off once a loop
+// vectorizes (e.g. -O3 -march=native), where they avoid the divider entirely.
+enum class RsqrtMode { Exact, Fast, FastRefined };
+
+template <RsqrtMode Mode = RsqrtMode::Exact>
+inline float rsqrt(float value) {
+    if constexpr (Mode == RsqrtMode::Exact) {
+        return 1.0f / std::sqrt(value);
+    } else {
+        std::uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        bits = 0x5f375a86u - (bits >> 1);
+        float y;
+        std::memcpy(&y, &bits, sizeof(y));
+        float halfValue = 0.5f * value;
+        y = y * (1.5f - halfValue * y * y);
+        if constexpr (Mode == RsqrtMode::FastRefined) {
+            y = y * (1.5f - halfValue * y * y);
+        }
+        return y;
+    }
+}
 
 struct Vector2f {
     float x, y;
     
-    Vector2f(float x = 0, float y = 0) : x(x), y(y) {}
+    constexpr Vector2f(float x = 0, float y = 0) : x(x), y(y) {}
     
-    Vector2f operator+(const Vector2f& other) const {
+    constexpr Vector2f operator+(const Vector2f& other) const {
         return Vector2f(x + other.x, y + other.y);
     }
     
-    Vector2f operator-(const Vector2f& other) const {
+    constexpr Vector2f operator-(const Vector2f& other) const {
         return Vector2f(x - other.x, y - other.y);
     }
     
-    Vector2f operator*(float scalar) const {
+    constexpr Vector2f operator-() const {
+        return Vector2f(-x, -y);
+    }
+    
+    constexpr Vector2f operator*(float scalar) const {
         return Vector2f(x * scalar, y * scalar);
     }
     
+    Vector2f& operator+=(const Vector2f& other) {
+        x += other.x;
+        y += other.y;
+        return *this;
+    }
+    
+    Vector2f& operator-=(const Vector2f& other) {
+        x -= other.x;
+        y -= other.y;
+        return *this;
+    }
+    
+    Vector2f& operator*=(float scalar) {
+        x *= scalar;
+        y *= scalar;
+        return *this;
+    }
+    
+    constexpr float dot(const Vector2f& other) const {
+        return x * other.x + y * other.y;
+    }
+    
+    // z component of the 3D cross product
+    constexpr float cross(const Vector2f& other) const {
+        return x * other.y - y * other.x;
+    }
+    
+    constexpr float lengthSquared() const {
+        return x * x + y * y;
+    }
+    
     float magnitude() const {
         return std::sqrt(x * x + y * y);
     }
@@ -35,138 +153,5042 @@ struct Vector2f {
     }
 };
 
-class BlackHole {
+constexpr Vector2f operator*(float scalar, const Vector2f& v) {
+    return v * scalar;
+}
+
+constexpr float distanceSquared(const Vector2f& a, const Vector2f& b) {
+    return (a - b).lengthSquared();
+}
+
+// Length, its reciprocal and the unit direction from a single square root
+struct LengthAndDirection {
+    float length;
+    float inverseLength;
+    Vector2f direction;
+};
+
+template <RsqrtMode Mode = RsqrtMode::Exact>
+inline LengthAndDirection lengthAndDirection(const Vector2f& v) {
+    float lengthSq = v.lengthSquared();
+    if constexpr (Mode == RsqrtMode::Exact) {
+        // sqrt first keeps the length off the divide's critical path
+        float length = std::sqrt(lengthSq);
+        float inverseLength = length > 0 ? 1.0f / length : 0.0f;
+        return {length, inverseLength, v * inverseLength};
+    } else {
+        float inverseLength = lengthSq > 0 ? rsqrt<Mode>(lengthSq) : 0.0f;
+        return {lengthSq * inverseLength, inverseLength, v * inverseLength};
+    }
+}
+
+// Non-owning view over contiguous elements
+template <typename T>
+struct Span {
+    T* data = nullptr;
+    std::size_t size = 0;
+    
+    constexpr Span() = default;
+    constexpr Span(T* d, std::size_t n) : data(d), size(n) {}
+    template <typename Container, typename = decltype(std::declval<Container&>().data())>
+    Span(Container& c) : data(c.data()), size(c.size()) {}
+    
+    constexpr T& operator[](std::size_t i) const { return data[i]; }
+    constexpr T* begin() const { return data; }
+    constexpr T* end() const { return data + size; }
+    constexpr bool empty() const { return size == 0; }
+};
+
+// Batch variants, written as flat loops so the compiler can vectorize them
+template <RsqrtMode Mode = RsqrtMode::Exact>
+inline void lengthsBatch(Span<const Vector2f> vectors, Span<float> lengths) {
+    for (std::size_t i = 0; i < vectors.size; i++) {
+        float lengthSq = vectors[i].lengthSquared();
+        lengths[i] = lengthSq > 0 ? lengthSq * rsqrt<Mode>(lengthSq) : 0.0f;
+    }
+}
+
+template <RsqrtMode Mode = RsqrtMode::Exact>
+inline void normalizeBatch(Span<Vector2f> vectors) {
+    for (std::size_t i = 0; i < vectors.size; i++) {
+        float lengthSq = vectors[i].lengthSquared();
+        float scale = lengthSq > 0 ? rsqrt<Mode>(lengthSq) : 0.0f;
+        vectors[i] *= scale;
+    }
+}
+
+inline void distanceSquaredBatch(const Vector2f& origin, Span<const Vector2f> points, Span<float> out) {
+    for (std::size_t i = 0; i < points.size; i++) {
+        out[i] = distanceSquared(points[i], origin);
+    }
+}
+
+// Reciprocal square root mode used by the ray integration kernel
+constexpr RsqrtMode RAY_KERNEL_RSQRT = RsqrtMode::Exact;
+
+// ---------------------------------------------------------------------------
+// Slot-map storage
+// ---------------------------------------------------------------------------
+
+// Generation-checked reference into a SlotMap. Stays valid across removals
+// of other elements and compares stale once its own element is removed.
+struct SlotHandle {
+    static constexpr std::uint32_t INVALID_INDEX = 0xffffffffu;
+    
+    std::uint32_t index = INVALID_INDEX;
+    std::uint32_t generation = 0;
+    
+    constexpr bool isValid() const { return index != INVALID_INDEX; }
+    constexpr bool operator==(const SlotHandle& other) const {
+        return index == other.index && generation == other.generation;
+    }
+    constexpr bool operator!=(const SlotHandle& other) const { return !(*this == other); }
+};
+
+// Elements live packed in a dense array for contiguous iteration. A sparse
+// slot table maps handles to dense positions; removal swaps the last element
+// into the hole so it is O(1) and never shifts the survivors.
+template <typename T, typename Allocator = std::allocator<T>>
+class SlotMap {
 private:
-    Vector2f position;
-    float mass;
-    float schwarzschildRadius;
-    sf::CircleShape shape;
-    sf::CircleShape eventHorizon;
+    struct Slot {
+        std::uint32_t denseIndex;   // next free slot while on the free list
+        std::uint32_t generation;
+    };
+    
+    std::vector<T, Allocator> dense;
+    std::vector<std::uint32_t> denseToSlot;
+    std::vector<Slot> slots;
+    std::uint32_t freeHead = SlotHandle::INVALID_INDEX;
     
 public:
-    BlackHole(Vector2f pos, float m) : position(pos), mass(m) {
-        // Schwarzschild radius (simplified for visualization)
-        schwarzschildRadius = mass * 0.01f;
-        
-        // Visual representation of the black hole
-        shape.setRadius(schwarzschildRadius);
-        shape.setFillColor(sf::Color::Black);
-        shape.setOrigin(schwarzschildRadius, schwarzschildRadius);
-        shape.setPosition(position.x, position.y);
+    template <typename... Args>
+    SlotHandle emplace(Args&&... args) {
+        std::uint32_t slotIndex;
+        if (freeHead != SlotHandle::INVALID_INDEX) {
+            slotIndex = freeHead;
+            freeHead = slots[slotIndex].denseIndex;
+        } else {
+            slotIndex = static_cast<std::uint32_t>(slots.size());
+            slots.push_back({0, 0});
+        }
+        dense.emplace_back(std::forward<Args>(args)...);
+        denseToSlot.push_back(slotIndex);
+        slots[slotIndex].denseIndex = static_cast<std::uint32_t>(dense.size() - 1);
+        return {slotIndex, slots[slotIndex].generation};
+    }
+    
+    bool contains(SlotHandle handle) const {
+        return handle.index < slots.size() && slots[handle.index].generation == handle.generation;
+    }
+    
+    T* get(SlotHandle handle) {
+        return contains(handle) ? &dense[slots[handle.index].denseIndex] : nullptr;
+    }
+    
+    const T* get(SlotHandle handle) const {
+        return contains(handle) ? &dense[slots[handle.index].denseIndex] : nullptr;
+    }
+    
+    std::size_t denseIndexOf(SlotHandle handle) const {
+        return slots[handle.index].denseIndex;
+    }
+    
+    SlotHandle handleAt(std::size_t denseIndex) const {
+        std::uint32_t slotIndex = denseToSlot[denseIndex];
+        return {slotIndex, slots[slotIndex].generation};
+    }
+    
+    bool erase(SlotHandle handle) {
+        if (!contains(handle)) return false;
+        eraseAt(slots[handle.index].denseIndex);
+        return true;
+    }
+    
+    // Swap-remove by dense position; the last element takes its place
+    void eraseAt(std::size_t denseIndex) {
+        std::uint32_t slotIndex = denseToSlot[denseIndex];
+        std::size_t last = dense.size() - 1;
+        if (denseIndex != last) {
+            dense[denseIndex] = std::move(dense[last]);
+            denseToSlot[denseIndex] = denseToSlot[last];
+            slots[denseToSlot[denseIndex]].denseIndex = static_cast<std::uint32_t>(denseIndex);
+        }
+        dense.pop_back();
+        denseToSlot.pop_back();
         
-        // Event horizon visualization
-        eventHorizon.setRadius(schwarzschildRadius * 1.5f);
-        eventHorizon.setFillColor(sf::Color::Transparent);
-        eventHorizon.setOutlineColor(sf::Color(100, 100, 100, 100));
-        eventHorizon.setOutlineThickness(2);
-        eventHorizon.setOrigin(schwarzschildRadius * 1.5f, schwarzschildRadius * 1.5f);
-        eventHorizon.setPosition(position.x, position.y);
+        // Bumping the generation invalidates every outstanding handle
+        slots[slotIndex].generation++;
+        slots[slotIndex].denseIndex = freeHead;
+        freeHead = slotIndex;
     }
     
-    Vector2f getPosition() const { return position; }
-    float getMass() const { return mass; }
-    float getSchwarzschildRadius() const { return schwarzschildRadius; }
+    template <typename Predicate>
+    std::size_t eraseIf(Predicate predicate) {
+        std::size_t removed = 0;
+        for (std::size_t i = 0; i < dense.size();) {
+            if (predicate(dense[i])) {
+                eraseAt(i);
+                removed++;
+            } else {
+                i++;
+            }
+        }
+        return removed;
+    }
     
-    void draw(sf::RenderWindow& window) {
-        window.draw(eventHorizon);
-        window.draw(shape);
+    void clear() {
+        while (!dense.empty()) eraseAt(dense.size() - 1);
+    }
+    
+    // Exchanges two dense positions; handles to both stay valid
+    void swapAt(std::size_t a, std::size_t b) {
+        if (a == b) return;
+        std::swap(dense[a], dense[b]);
+        std::swap(denseToSlot[a], denseToSlot[b]);
+        slots[denseToSlot[a]].denseIndex = static_cast<std::uint32_t>(a);
+        slots[denseToSlot[b]].denseIndex = static_cast<std::uint32_t>(b);
+    }
+    
+    // Reorders the first order.size() elements so that element i becomes the
+    // old element order[i]; the rest keep their place and handles stay valid.
+    // Follows the permutation's cycles in place, so nothing is allocated and
+    // each element moves once plus once per cycle. While it runs, a slot whose
+    // denseIndex reads INVALID_INDEX belongs to an element not yet placed.
+    void permute(const std::vector<std::uint32_t>& order) {
+        const std::uint32_t unplaced = SlotHandle::INVALID_INDEX;
+        for (std::size_t i = 0; i < order.size(); i++) slots[denseToSlot[i]].denseIndex = unplaced;
+        for (std::size_t start = 0; start < order.size(); start++) {
+            if (slots[denseToSlot[start]].denseIndex != unplaced) continue;
+            if (order[start] == start) {
+                slots[denseToSlot[start]].denseIndex = static_cast<std::uint32_t>(start);
+                continue;
+            }
+            T held = std::move(dense[start]);
+            std::uint32_t heldSlot = denseToSlot[start];
+            std::size_t j = start;
+            while (order[j] != start) {
+                std::size_t source = order[j];
+                dense[j] = std::move(dense[source]);
+                denseToSlot[j] = denseToSlot[source];
+                slots[denseToSlot[j]].denseIndex = static_cast<std::uint32_t>(j);
+                j = source;
+            }
+            dense[j] = std::move(held);
+            denseToSlot[j] = heldSlot;
+            slots[heldSlot].denseIndex = static_cast<std::uint32_t>(j);
+        }
     }
+    
+    void reserve(std::size_t capacity) {
+        dense.reserve(capacity);
+        denseToSlot.reserve(capacity);
+        slots.reserve(capacity);
+    }
+    
+    std::size_t size() const { return dense.size(); }
+    bool empty() const { return dense.empty(); }
+    
+    T* data() { return dense.data(); }
+    const T* data() const { return dense.data(); }
+    T& operator[](std::size_t denseIndex) { return dense[denseIndex]; }
+    const T& operator[](std::size_t denseIndex) const { return dense[denseIndex]; }
+    
+    auto begin() { return dense.begin(); }
+    auto end() { return dense.end(); }
+    auto begin() const { return dense.begin(); }
+    auto end() const { return dense.end(); }
 };
 
-class LightRay {
+using RayHandle = SlotHandle;
+
+// ---------------------------------------------------------------------------
+// Worker pool
+// ---------------------------------------------------------------------------
+
+// Persistent threads for data-parallel loops. The calling thread takes part
+// as worker 0, so a pool of size 1 runs everything inline. An exception
+// thrown by any worker is rethrown on the caller once every worker is done.
+// parallelForDynamic schedules chunks work-stealing style: each worker starts
+// on its own contiguous share and steals from the others once it runs dry.
+class WorkerPool {
 private:
-    std::vector<Vector2f> path;
-    Vector2f currentPosition;
-    Vector2f currentVelocity;
-    sf::Color color;
-    float impactParameter;
-    bool absorbed;
+    struct TaskRange {
+        std::size_t begin, end;
+    };
+    
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<TaskRange> tasks;
+    };
+    
+    std::vector<std::thread> threads;
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::mutex mutex;
+    std::condition_variable workReady;
+    std::condition_variable workDone;
+    std::function<void(unsigned)> job;
+    std::uint64_t jobGeneration = 0;
+    unsigned pendingWorkers = 0;
+    std::exception_ptr jobError;    // first exception thrown by a pool thread
+    bool stopping = false;
+    
+    static bool& parallelRegionFlag() {
+        static thread_local bool inside = false;
+        return inside;
+    }
+    
+    void workerLoop(unsigned workerIndex) {
+        parallelRegionFlag() = true;
+        std::uint64_t seenGeneration = 0;
+        while (true) {
+            std::function<void(unsigned)> current;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                workReady.wait(lock, [&] { return stopping || jobGeneration != seenGeneration; });
+                if (stopping) return;
+                seenGeneration = jobGeneration;
+                current = job;
+            }
+            std::exception_ptr error;
+            try {
+                current(workerIndex);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (error && !jobError) jobError = error;
+                if (--pendingWorkers == 0) workDone.notify_one();
+            }
+        }
+    }
+    
+    // Own work comes off the back (most recently queued, still cache-warm),
+    // stolen work off the front of a victim's queue
+    bool nextTask(unsigned worker, TaskRange& task) {
+        {
+            WorkQueue& own = *queues[worker];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = own.tasks.back();
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        for (unsigned offset = 1; offset < queues.size(); offset++) {
+            WorkQueue& victim = *queues[(worker + offset) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = victim.tasks.front();
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
     
 public:
-    LightRay(Vector2f startPos, Vector2f initialVel, sf::Color c) 
-        : currentPosition(startPos), currentVelocity(initialVel), color(c), absorbed(false) {
-        path.push_back(startPos);
-        // Impact parameter is the perpendicular distance from the trajectory to the black hole
-        impactParameter = std::abs(startPos.y - WINDOW_HEIGHT / 2.0f);
+    explicit WorkerPool(unsigned workerCount = std::max(1u, std::thread::hardware_concurrency())) {
+        for (unsigned i = 0; i < workerCount; i++) {
+            queues.push_back(std::make_unique<WorkQueue>());
+        }
+        for (unsigned i = 1; i < workerCount; i++) {
+            threads.emplace_back(&WorkerPool::workerLoop, this, i);
+        }
     }
     
-    void update(const BlackHole& blackHole, float deltaTime) {
-        if (absorbed) return;
-        
-        Vector2f blackHolePos = blackHole.getPosition();
-        Vector2f toBlackHole = blackHolePos - currentPosition;
-        float distance = toBlackHole.magnitude();
-        
-        // Check if ray is absorbed by black hole
-        if (distance < blackHole.getSchwarzschildRadius()) {
-            absorbed = true;
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        workReady.notify_all();
+        for (auto& thread : threads) thread.join();
+    }
+    
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+    
+    unsigned size() const { return static_cast<unsigned>(threads.size()) + 1; }
+    
+    // True on pool threads and on the caller while it runs its share of a
+    // job; nested parallel loops from there would deadlock
+    static bool inParallelRegion() { return parallelRegionFlag(); }
+    
+    // Restricts each worker to the CPUs of one NUMA node, spreading workers
+    // over nodes in contiguous groups so static chunks stay node-local.
+    // nodeCpus[n] lists the CPUs of node n. Returns false if unsupported.
+    bool pinToNodes(const std::vector<std::vector<int>>& nodeCpus) {
+#if defined(__linux__)
+        if (nodeCpus.empty()) return false;
+        unsigned workers = size();
+        auto pin = [&](pthread_t thread, unsigned worker) {
+            const std::vector<int>& cpus = nodeCpus[worker * nodeCpus.size() / workers];
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            for (int cpu : cpus) CPU_SET(cpu, &set);
+            return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+        };
+        bool ok = pin(pthread_self(), 0);
+        for (unsigned i = 1; i < workers; i++) ok = pin(threads[i - 1].native_handle(), i) && ok;
+        return ok;
+#else
+        (void)nodeCpus;
+        return false;
+#endif
+    }
+    
+    // Runs fn(workerIndex) once on every worker and waits for all of them.
+    // The wait also runs when the caller's share throws, so no worker is left
+    // running a job whose captures have gone out of scope. The caller's own
+    // exception wins; otherwise the first one from a pool thread is rethrown.
+    void runOnAll(const std::function<void(unsigned)>& fn) {
+        struct RegionGuard {
+            bool previous = parallelRegionFlag();
+            RegionGuard() { parallelRegionFlag() = true; }
+            ~RegionGuard() { parallelRegionFlag() = previous; }
+        };
+        struct WaitGuard {
+            WorkerPool& pool;
+            ~WaitGuard() {
+                std::unique_lock<std::mutex> lock(pool.mutex);
+                pool.workDone.wait(lock, [&] { return pool.pendingWorkers == 0; });
+            }
+        };
+        if (threads.empty()) {
+            RegionGuard guard;
+            fn(0);
             return;
         }
-        
-        // Gravitational acceleration using simplified general relativity
-        // F = G*M/r^2, but for light we use deflection angle approximation
-        float gravitationalConstant = blackHole.getMass() * 10000.0f;
-        
-        // Calculate gravitational acceleration
-        Vector2f acceleration = toBlackHole.normalized() * (gravitationalConstant / (distance * distance));
-        
-        // Apply relativistic correction for light deflection
-        // Deflection angle ≈ 4GM/(c²b) where b is impact parameter
-        float deflectionFactor = 1.0f + (gravitationalConstant * 0.001f) / (distance * impactParameter + 1.0f);
-        acceleration = acceleration * deflectionFactor;
-        
-        // Update velocity and position using Verlet integration
-        currentVelocity = currentVelocity + acceleration * deltaTime;
-        
-        // Maintain approximately constant speed for light
-        float lightSpeed = 200.0f;
-        currentVelocity = currentVelocity.normalized() * lightSpeed;
-        
-        currentPosition = currentPosition + currentVelocity * deltaTime;
-        
-        // Add point to path for visualization
-        if (path.size() == 0 || (currentPosition - path.back()).magnitude() > 2.0f) {
-            path.push_back(currentPosition);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = fn;
+            jobError = nullptr;
+            pendingWorkers = static_cast<unsigned>(threads.size());
+            jobGeneration++;
+        }
+        workReady.notify_all();
+        {
+            WaitGuard wait{*this};
+            RegionGuard guard;
+            fn(0);
         }
+        std::exception_ptr error;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::swap(error, jobError);
+        }
+        if (error) std::rethrow_exception(error);
     }
     
-    void draw(sf::RenderWindow& window) const {
-        if (path.size() < 2) return;
-        
-        // Draw the light ray path
-        for (size_t i = 1; i < path.size(); i++) {
-            sf::Vertex line[] = {
-                sf::Vertex(sf::Vector2f(path[i-1].x, path[i-1].y), color),
-                sf::Vertex(sf::Vector2f(path[i].x, path[i].y), color)
-            };
-            window.draw(line, 2, sf::Lines);
+    // Splits [0, count) into one contiguous chunk per worker and calls
+    // fn(begin, end, workerIndex) for each chunk
+    template <typename Fn>
+    void parallelFor(std::size_t count, Fn&& fn) {
+        unsigned workers = size();
+        if (count == 0) return;
+        runOnAll([&](unsigned worker) {
+            std::size_t begin = count * worker / workers;
+            std::size_t end = count * (worker + 1) / workers;
+            if (begin < end) fn(begin, end, worker);
+        });
+    }
+    
+    // Splits [0, count) into chunks of at most grain items, balanced by
+    // work stealing; for loops whose iterations vary a lot in cost
+    template <typename Fn>
+    void parallelForDynamic(std::size_t count, std::size_t grain, Fn&& fn) {
+        if (count == 0) return;
+        grain = std::max<std::size_t>(1, grain);
+        unsigned workers = size();
+        std::size_t chunks = (count + grain - 1) / grain;
+        for (unsigned w = 0; w < workers; w++) {
+            std::size_t firstChunk = chunks * w / workers;
+            std::size_t lastChunk = chunks * (w + 1) / workers;
+            std::lock_guard<std::mutex> lock(queues[w]->mutex);
+            // Pushed in reverse so the owner pops its share front to back
+            for (std::size_t c = lastChunk; c-- > firstChunk;) {
+                queues[w]->tasks.push_back({c * grain, std::min(count, (c + 1) * grain)});
+            }
+        }
+        try {
+            runOnAll([&](unsigned worker) {
+                TaskRange task;
+                while (nextTask(worker, task)) {
+                    fn(task.begin, task.end, worker);
+                }
+            });
+        } catch (...) {
+            // Ranges left behind by a failed worker must not leak into the next loop
+            for (auto& queue : queues) {
+                std::lock_guard<std::mutex> lock(queue->mutex);
+                queue->tasks.clear();
+            }
+            throw;
+        }
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Lock-free command queue
+// ---------------------------------------------------------------------------
+
+// Bounded multi-producer single-consumer ring (Vyukov's sequence-numbered
+// cells). Producers claim a cell with one CAS and publish it by bumping its
+// sequence; the consumer never writes shared counters, so a push costs a few
+// uncontended atomics and never allocates or blocks. A full ring rejects the
+// push instead of waiting.
+template <typename T, std::size_t Capacity>
+class MpscQueue {
+    static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+    static_assert(std::is_trivially_copyable_v<T>, "elements are copied in and out of cells");
+    
+private:
+    struct Cell {
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+    
+    std::array<Cell, Capacity> cells;
+    alignas(64) std::atomic<std::size_t> enqueuePosition{0};
+    alignas(64) std::size_t dequeuePosition = 0;
+    
+public:
+    MpscQueue() {
+        for (std::size_t i = 0; i < Capacity; i++) cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+    
+    // Safe from any thread; returns false when the ring is full
+    bool tryPush(const T& value) {
+        std::size_t position = enqueuePosition.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[position & (Capacity - 1)];
+            std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            auto difference = static_cast<std::ptrdiff_t>(sequence - position);
+            if (difference == 0) {
+                if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    cell.value = value;
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = enqueuePosition.load(std::memory_order_relaxed);
+            }
+        }
+    }
+    
+    // Consumer thread only
+    bool tryPop(T& value) {
+        Cell& cell = cells[dequeuePosition & (Capacity - 1)];
+        std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        if (static_cast<std::ptrdiff_t>(sequence - (dequeuePosition + 1)) < 0) return false;
+        value = cell.value;
+        cell.sequence.store(dequeuePosition + Capacity, std::memory_order_release);
+        dequeuePosition++;
+        return true;
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Ray memory allocation policy
+// ---------------------------------------------------------------------------
+
+// Placement policy for ray and trajectory storage. Large blocks are mapped
+// directly so they can be backed by huge pages, and first-touched by the
+// worker pool in the same contiguous chunks parallelFor hands out, so each
+// page lands on the NUMA node of the worker that will update it. Small
+// blocks (most trails) use malloc; they are grown inside the parallel update
+// and so are first-touched by their owning worker anyway.
+struct MemoryPolicy {
+    bool transparentHugePages = false;  // madvise(MADV_HUGEPAGE)
+    bool hugeTLB = false;               // MAP_HUGETLB, falls back if no pages are reserved
+    bool firstTouch = false;
+    bool pinWorkers = false;            // pin pool workers to NUMA nodes
+    std::size_t mapThreshold = std::size_t(1) << 20;
+    WorkerPool* firstTouchPool = nullptr;
+};
+
+inline MemoryPolicy& memoryPolicy() {
+    static MemoryPolicy policy;
+    return policy;
+}
+
+// CPU lists of each NUMA node from sysfs; a single node holding every CPU
+// when the information is unavailable
+inline std::vector<std::vector<int>> numaNodeCpus() {
+    std::vector<std::vector<int>> nodes;
+    for (int node = 0;; node++) {
+        std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if (!in) break;
+        std::vector<int> cpus;
+        std::string range;
+        while (std::getline(in, range, ',')) {
+            std::size_t dash = range.find('-');
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+        }
+        nodes.push_back(cpus);
+    }
+    if (nodes.empty()) {
+        std::vector<int> all;
+        for (unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); cpu++) all.push_back(cpu);
+        nodes.push_back(all);
+    }
+    return nodes;
+}
+
+namespace memory_detail {
+    const std::size_t HUGE_PAGE_SIZE = std::size_t(2) << 20;
+    const std::size_t PAGE_SIZE = 4096;
+    
+    // Running totals for the metrics endpoint
+    inline std::atomic<std::uint64_t> allocations{0};
+    inline std::atomic<std::uint64_t> allocatedBytes{0};
+    inline std::atomic<std::uint64_t> freedBytes{0};
+    
+    inline std::size_t mappedSize(std::size_t bytes) {
+        return (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    }
+    
+    inline void* allocate(std::size_t bytes) {
+        const MemoryPolicy& policy = memoryPolicy();
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        allocatedBytes.fetch_add(bytes, std::memory_order_relaxed);
+#if defined(__linux__)
+        if (bytes >= policy.mapThreshold) {
+            std::size_t size = mappedSize(bytes);
+            void* block = MAP_FAILED;
+            if (policy.hugeTLB) {
+                block = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            }
+            if (block == MAP_FAILED) {
+                block = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (block == MAP_FAILED) throw std::bad_alloc();
+                if (policy.transparentHugePages) madvise(block, size, MADV_HUGEPAGE);
+            }
+            if (policy.firstTouch && policy.firstTouchPool && !WorkerPool::inParallelRegion()) {
+                std::size_t pages = size / PAGE_SIZE;
+                char* base = static_cast<char*>(block);
+                policy.firstTouchPool->parallelFor(pages, [&](std::size_t begin, std::size_t end, unsigned) {
+                    for (std::size_t page = begin; page < end; page++) base[page * PAGE_SIZE] = 0;
+                });
+            }
+            return block;
+        }
+#endif
+        void* block = std::malloc(bytes);
+        if (!block) throw std::bad_alloc();
+        return block;
+    }
+    
+    inline void deallocate(void* block, std::size_t bytes) {
+        freedBytes.fetch_add(bytes, std::memory_order_relaxed);
+#if defined(__linux__)
+        if (bytes >= memoryPolicy().mapThreshold) {
+            munmap(block, mappedSize(bytes));
+            return;
+        }
+#endif
+        std::free(block);
+    }
+}
+
+// Stateless allocator applying the global MemoryPolicy. The map threshold
+// must not change while blocks are live, since deallocate relies on it.
+template <typename T>
+struct PolicyAllocator {
+    using value_type = T;
+    
+    PolicyAllocator() = default;
+    template <typename U>
+    PolicyAllocator(const PolicyAllocator<U>&) {}
+    
+    T* allocate(std::size_t n) { return static_cast<T*>(memory_detail::allocate(n * sizeof(T))); }
+    void deallocate(T* p, std::size_t n) { memory_detail::deallocate(p, n * sizeof(T)); }
+    
+    template <typename U>
+    bool operator==(const PolicyAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const PolicyAllocator<U>&) const { return false; }
+};
+
+using Trajectory = std::vector<Vector2f, PolicyAllocator<Vector2f>>;
+
+// ---------------------------------------------------------------------------
+// Trajectory storage
+// ---------------------------------------------------------------------------
+
+enum class PathStorage { Float, Quantized };
+
+// Storage used for paths started from now on; existing paths keep theirs
+inline PathStorage& pathStorage() {
+    static PathStorage storage = PathStorage::Float;
+    return storage;
+}
+
+// Quantized point: offset from its chunk origin in 1/PATH_FIXED_SCALE px
+struct PackedPoint {
+    std::int16_t x;
+    std::int16_t y;
+};
+
+struct PathChunk {
+    Vector2f origin;
+    std::uint32_t start;    // index of the chunk's first point
+};
+
+constexpr float PATH_FIXED_SCALE = 16.0f;   // 1/32 px per axis, +-2047 px reach
+static_assert(PATH_FIXED_SCALE == BH_PATH_FIXED_SCALE, "C API scale must match");
+
+// Trail length limit for paths started from now on. points == 0 and
+// seconds == 0 keep whole trajectories. With only seconds set, the ring is
+// sized from the spacing rule: points are more than 2 px apart and rays move
+// at most LIGHT_SPEED, so no more than LIGHT_SPEED / 2 arrive per second.
+struct TrailWindow {
+    std::uint32_t points = 0;
+    float seconds = 0.0f;
+    
+    std::size_t capacity() const {
+        if (points) return points;
+        return seconds > 0 ? static_cast<std::size_t>(std::ceil(seconds * LIGHT_SPEED / 2.0f)) + 1 : 0;
+    }
+};
+
+inline TrailWindow& trailWindow() {
+    static TrailWindow window;
+    return window;
+}
+
+// Older points followed by newer ones; second is empty unless a ring wrapped
+struct PathSpans {
+    Span<const Vector2f> first;
+    Span<const Vector2f> second;
+    
+    std::size_t size() const { return first.size + second.size; }
+};
+
+// Storage slots holding a path's points, oldest first: [start, start +
+// firstCount) then [0, secondCount) once a ring has wrapped
+struct PathSlots {
+    std::size_t start;
+    std::size_t firstCount;
+    std::size_t secondCount;
+};
+
+// A ray's recorded trajectory, either as plain floats or as 16-bit fixed
+// point offsets from per-chunk origins (4 bytes per point instead of 8).
+// A chunk starts every PATH_CHUNK_POINTS points or whenever a point would
+// fall out of range, so the error never accumulates along the path.
+//
+// With a TrailWindow the points live in a ring of fixed capacity that is
+// allocated once, and the oldest are overwritten. Points are numbered by a
+// running logical index, so chunk starts stay meaningful as the ring turns;
+// a chunk also starts at the ring's wrap so each one is contiguous.
+class RayPath {
+public:
+    static constexpr std::size_t PATH_CHUNK_POINTS = 64;
+    
+private:
+    PathStorage storage;
+    std::size_t capacity;       // ring slots; 0 grows without limit
+    float window;               // seconds of trail kept; 0 = no age limit
+    Trajectory points;
+    std::vector<PackedPoint, PolicyAllocator<PackedPoint>> packed;
+    std::vector<PathChunk> chunks;
+    std::vector<float> times;   // per ring slot, only with an age limit
+    std::uint64_t first = 0;    // logical index of the oldest kept point
+    std::uint64_t next = 0;     // logical index of the next point
+    Vector2f last;
+    
+    // The fixed trip count lets -O2 vectorize full chunks without a scalar tail
+    static void decodeFullChunk(const PackedPoint* __restrict in, Vector2f* __restrict out, Vector2f origin) {
+        const float inverseScale = 1.0f / PATH_FIXED_SCALE;
+        for (std::size_t i = 0; i < PATH_CHUNK_POINTS; i++) {
+            out[i].x = origin.x + in[i].x * inverseScale;
+            out[i].y = origin.y + in[i].y * inverseScale;
+        }
+    }
+    
+    static void decodeRun(const PackedPoint* __restrict in, Vector2f* __restrict out, std::size_t count, Vector2f origin) {
+        const float inverseScale = 1.0f / PATH_FIXED_SCALE;
+        for (std::size_t i = 0; i < count; i++) {
+            out[i].x = origin.x + in[i].x * inverseScale;
+            out[i].y = origin.y + in[i].y * inverseScale;
+        }
+    }
+    
+    static bool inRange(Vector2f offset) {
+        const float reach = 32767.0f / PATH_FIXED_SCALE;
+        return std::abs(offset.x) <= reach && std::abs(offset.y) <= reach;
+    }
+    
+    // Chunk starts are logical indices truncated to 32 bits
+    std::uint64_t chunkStart(std::size_t c) const {
+        return next - static_cast<std::uint32_t>(static_cast<std::uint32_t>(next) - chunks[c].start);
+    }
+    
+    std::uint64_t chunkEnd(std::size_t c) const { return c + 1 < chunks.size() ? chunkStart(c + 1) : next; }
+    
+    std::size_t slotOf(std::uint64_t logical) const { return capacity ? logical % capacity : logical; }
+    
+    void pushPacked(Vector2f p, std::size_t slot) {
+        bool startChunk = chunks.empty() || next - chunkStart(chunks.size() - 1) >= PATH_CHUNK_POINTS ||
+                          (capacity && slot == 0) || !inRange(p - chunks.back().origin);
+        if (startChunk) {
+            // A full chunk table gives up its oldest chunk early
+            if (capacity && chunks.size() == chunks.capacity()) {
+                first = std::max(first, chunkEnd(0));
+                chunks.erase(chunks.begin());
+            }
+            chunks.push_back({p, static_cast<std::uint32_t>(next)});
+        }
+        Vector2f offset = (p - chunks.back().origin) * PATH_FIXED_SCALE;
+        PackedPoint point{static_cast<std::int16_t>(std::lround(offset.x)), static_cast<std::int16_t>(std::lround(offset.y))};
+        if (capacity) packed[slot] = point;
+        else packed.push_back(point);
+    }
+    
+public:
+    explicit RayPath(PathStorage storage = pathStorage(), const TrailWindow& trail = trailWindow())
+        : storage(storage), capacity(trail.capacity()), window(trail.seconds) {
+        if (capacity == 0) return;
+        if (storage == PathStorage::Float) {
+            points.resize(capacity);
+        } else {
+            packed.resize(capacity);
+            // Room for every chunk a full window can touch, plus the wrap break
+            chunks.reserve(capacity / PATH_CHUNK_POINTS + 3);
+        }
+        if (window > 0) times.resize(capacity);
+    }
+    
+    // time is the ray's age in seconds; it only matters with an age limit
+    void push_back(Vector2f p, float time = 0.0f) {
+        last = p;
+        if (capacity && next - first == capacity) first++;
+        std::size_t slot = slotOf(next);
+        if (storage == PathStorage::Float) {
+            if (capacity) points[slot] = p;
+            else points.push_back(p);
+        } else {
+            pushPacked(p, slot);
+        }
+        if (window > 0) times[slot] = time;
+        next++;
+        
+        if (window > 0) {
+            while (next - first > 1 && times[slotOf(first)] < time - window) first++;
+        }
+        while (chunks.size() > 1 && chunkStart(1) <= first) chunks.erase(chunks.begin());
+    }
+    
+    std::size_t size() const { return static_cast<std::size_t>(next - first); }
+    bool empty() const { return size() == 0; }
+    // Exact last point, so the spacing test is unaffected by quantization
+    Vector2f back() const { return last; }
+    PathStorage getStorage() const { return storage; }
+    // Fixed number of points kept, or 0 when the path grows without limit
+    std::size_t getCapacity() const { return capacity; }
+    // Logical index of the oldest kept point; 0 until a ring drops points
+    std::uint64_t firstIndex() const { return first; }
+    
+    // Bytes reserved for the points, chunk table and timestamps
+    std::size_t bytes() const {
+        return points.capacity() * sizeof(Vector2f) + packed.capacity() * sizeof(PackedPoint) +
+               chunks.capacity() * sizeof(PathChunk) + times.capacity() * sizeof(float);
+    }
+    
+    PathSlots slots() const {
+        std::size_t start = slotOf(first);
+        std::size_t count = size();
+        if (capacity == 0 || start + count <= capacity) return {start, count, 0};
+        return {start, capacity - start, start + count - capacity};
+    }
+    
+    // Float mode returns the stored points, as two spans once a ring has
+    // wrapped; quantized mode decodes into scratch, one flat loop per chunk
+    // so the conversion vectorizes
+    PathSpans decode(std::vector<Vector2f>& scratch) const {
+        if (storage == PathStorage::Float) {
+            PathSlots s = slots();
+            return {Span<const Vector2f>(points.data() + s.start, s.firstCount),
+                    Span<const Vector2f>(points.data(), s.secondCount)};
+        }
+        scratch.resize(size());
+        for (std::size_t c = 0; c < chunks.size(); c++) {
+            std::uint64_t begin = std::max(chunkStart(c), first);
+            std::uint64_t end = chunkEnd(c);
+            if (end <= begin) continue;
+            const PackedPoint* in = packed.data() + slotOf(begin);
+            Vector2f* out = scratch.data() + (begin - first);
+            if (end - begin == PATH_CHUNK_POINTS) {
+                decodeFullChunk(in, out, chunks[c].origin);
+            } else {
+                decodeRun(in, out, end - begin, chunks[c].origin);
+            }
+        }
+        return {Span<const Vector2f>(scratch.data(), scratch.size()), {}};
+    }
+    
+    // Raw storage for zero-copy views; only the one matching the mode is
+    // filled. Use slots() to find the kept points in a ring.
+    const Trajectory& floatPoints() const { return points; }
+    const std::vector<PackedPoint, PolicyAllocator<PackedPoint>>& packedPoints() const { return packed; }
+    const std::vector<PathChunk>& pathChunks() const { return chunks; }
+};
+
+// ---------------------------------------------------------------------------
+// Photon flux heatmap
+// ---------------------------------------------------------------------------
+
+// Per-worker deposit target handed to the ray kernel
+struct FluxWriter {
+    float* cells;
+    int width;
+    int height;
+    float cellsPerUnit;
+    
+    void deposit(const Vector2f& p) const {
+        int cx = static_cast<int>(p.x * cellsPerUnit);
+        int cy = static_cast<int>(p.y * cellsPerUnit);
+        if (p.x >= 0 && p.y >= 0 && cx < width && cy < height) {
+            cells[cy * width + cx] += 1.0f;
+        }
+    }
+};
+
+// Cumulative photon density over the window. Each worker deposits into its
+// own private grid without synchronization; resolve() merges the private
+// grids with a pairwise tree reduction and folds them into the decayed total.
+// Resolving is only needed before the grid is read, so deposits stay the only
+// per-step cost.
+class FluxAccumulator {
+private:
+    int width;
+    int height;
+    float cellSize;
+    float decayPerSecond;
+    float unresolvedTime = 0.0f;
+    std::vector<std::vector<float>> privateGrids;
+    std::vector<float> grid;
+    
+public:
+    // cellSize is in pixels; decayPerSecond is the fraction kept after one
+    // second (1 keeps everything)
+    FluxAccumulator(float worldWidth, float worldHeight, float cellSize, unsigned workers, float decayPerSecond = 1.0f)
+        : decayPerSecond(decayPerSecond) {
+        setResolution(worldWidth, worldHeight, cellSize, workers);
+    }
+    
+    void setResolution(float worldWidth, float worldHeight, float newCellSize, unsigned workers) {
+        cellSize = newCellSize;
+        width = std::max(1, static_cast<int>(std::ceil(worldWidth / cellSize)));
+        height = std::max(1, static_cast<int>(std::ceil(worldHeight / cellSize)));
+        privateGrids.assign(workers, std::vector<float>(static_cast<std::size_t>(width) * height, 0.0f));
+        grid.assign(static_cast<std::size_t>(width) * height, 0.0f);
+    }
+    
+    void setDecay(float fractionKeptPerSecond) { decayPerSecond = fractionKeptPerSecond; }
+    
+    FluxWriter writer(unsigned worker) {
+        return {privateGrids[worker].data(), width, height, 1.0f / cellSize};
+    }
+    
+    // Records simulated time so the decay can be applied at the next resolve
+    void advance(float deltaTime) { unresolvedTime += deltaTime; }
+    
+    void resolve(WorkerPool& pool) {
+        std::size_t cellCount = grid.size();
+        std::size_t grids = privateGrids.size();
+        
+        // Tree reduction: at each level grid i absorbs grid i + stride
+        for (std::size_t stride = 1; stride < grids; stride *= 2) {
+            pool.parallelFor(cellCount, [&](std::size_t begin, std::size_t end, unsigned) {
+                for (std::size_t g = 0; g + stride < grids; g += 2 * stride) {
+                    float* target = privateGrids[g].data();
+                    float* source = privateGrids[g + stride].data();
+                    for (std::size_t i = begin; i < end; i++) {
+                        target[i] += source[i];
+                        source[i] = 0.0f;
+                    }
+                }
+            });
+        }
+        
+        float decay = decayPerSecond < 1.0f ? std::pow(decayPerSecond, unresolvedTime) : 1.0f;
+        unresolvedTime = 0.0f;
+        pool.parallelFor(cellCount, [&](std::size_t begin, std::size_t end, unsigned) {
+            float* total = grid.data();
+            float* frame = privateGrids[0].data();
+            for (std::size_t i = begin; i < end; i++) {
+                total[i] = total[i] * decay + frame[i];
+                frame[i] = 0.0f;
+            }
+        });
+    }
+    
+    void clear() {
+        unresolvedTime = 0.0f;
+        std::fill(grid.begin(), grid.end(), 0.0f);
+        for (auto& g : privateGrids) std::fill(g.begin(), g.end(), 0.0f);
+    }
+    
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    float getCellSize() const { return cellSize; }
+    const std::vector<float>& getGrid() const { return grid; }
+    
+    float maxValue() const {
+        return grid.empty() ? 0.0f : *std::max_element(grid.begin(), grid.end());
+    }
+    
+    // Writes the cumulative grid as a greyscale Portable Float Map
+    bool exportPFM(const std::string& filename) const {
+        std::ofstream out(filename, std::ios::binary);
+        if (!out) return false;
+        writePFM(out);
+        return static_cast<bool>(out);
+    }
+    
+    void writePFM(std::ostream& out) const {
+        out << "Pf\n" << width << " " << height << "\n-1.0\n";
+        // PFM stores rows bottom to top, little-endian
+        for (int y = height - 1; y >= 0; y--) {
+            out.write(reinterpret_cast<const char*>(&grid[static_cast<std::size_t>(y) * width]),
+                      sizeof(float) * width);
+        }
+    }
+};
+
+class BlackHole {
+private:
+    Vector2f position;
+    float mass;
+    float spin;
+    float schwarzschildRadius;
+    sf::CircleShape shape;
+    sf::CircleShape eventHorizon;
+    
+public:
+    BlackHole(Vector2f pos, float m, float a = 0.0f) : position(pos), mass(m), spin(a) {
+        updateShapes();
+    }
+    
+    void updateShapes() {
+        // Schwarzschild radius (simplified for visualization)
+        schwarzschildRadius = mass * 0.01f;
+        
+        // Visual representation of the black hole
+        shape.setRadius(schwarzschildRadius);
+        shape.setFillColor(sf::Color::Black);
+        shape.setOrigin(schwarzschildRadius, schwarzschildRadius);
+        shape.setPosition(position.x, position.y);
+        
+        // Event horizon visualization
+        eventHorizon.setRadius(schwarzschildRadius * 1.5f);
+        eventHorizon.setFillColor(sf::Color::Transparent);
+        eventHorizon.setOutlineColor(sf::Color(100, 100, 100, 100));
+        eventHorizon.setOutlineThickness(2);
+        eventHorizon.setOrigin(schwarzschildRadius * 1.5f, schwarzschildRadius * 1.5f);
+        eventHorizon.setPosition(position.x, position.y);
+    }
+    
+    Vector2f getPosition() const { return position; }
+    float getMass() const { return mass; }
+    
+    void setMass(float m) {
+        mass = std::max(1.0f, m);
+        updateShapes();
+    }
+    
+    void setPosition(Vector2f pos) {
+        position = pos;
+        updateShapes();
+    }
+    float getSchwarzschildRadius() const { return schwarzschildRadius; }
+    
+    // Dimensionless spin a/M in [-1, 1]; positive spin rotates towards +phi
+    // in screen coordinates
+    float getSpin() const { return spin; }
+    void setSpin(float a) { spin = std::clamp(a, -1.0f, 1.0f); }
+    
+    // GM/c^2 in pixels, consistent with the acceleration used by LightRay
+    float getGravitationalRadius() const {
+        return mass * GRAVITY_SCALE / (LIGHT_SPEED * LIGHT_SPEED);
+    }
+    
+    void draw(sf::RenderWindow& window) const {
+        window.draw(eventHorizon);
+        window.draw(shape);
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Kerr equatorial photon engine
+// ---------------------------------------------------------------------------
+
+// Photon state in the equatorial plane of a Kerr hole (Boyer-Lindquist
+// coordinates, lengths in pixels). Energy is normalized to 1 and the
+// angular momentum is the impact parameter, so only r, dr/dlambda, phi and
+// t need integrating.
+struct KerrPhoton {
+    double r = 0;
+    double radialVelocity = 0;  // dr/dlambda
+    double phi = 0;
+    double t = 0;               // coordinate time in pixels (c = 1)
+    double impactParameter = 0; // L / E
+    bool initialized = false;
+    bool captured = false;
+};
+
+// Integrates equatorial null geodesics using the energy and angular-momentum
+// first integrals. With E = 1 and L = b:
+//   P = r^2 + a^2 - a b,   Delta = r^2 - 2Mr + a^2
+//   R = P^2 - Delta (b - a)^2,   (dr/dlambda)^2 = R / r^4
+//   d2r/dlambda2 = (R' r - 4R) / (2 r^5)
+//   dphi/dlambda = ((b - a) + a P / Delta) / r^2
+//   dt/dlambda   = (a (b - a) + (r^2 + a^2) P / Delta) / r^2
+// The second-order radial equation avoids tracking the sign of the root at
+// turning points.
+class KerrPhotonEngine {
+private:
+    double stepTolerance;   // step as a fraction of the distance to the horizon
+    double minStep;
+    double maxStep;
+    
+    struct Derivatives {
+        double r, radialVelocity, phi, t;
+    };
+    
+    static Derivatives evaluate(double r, double radialVelocity, double b, double m, double a) {
+        double r2 = r * r;
+        double bMinusA = b - a;
+        double p = r2 + a * a - a * b;
+        double delta = r2 - 2.0 * m * r + a * a;
+        double bigR = p * p - delta * bMinusA * bMinusA;
+        double bigRPrime = 4.0 * r * p - (2.0 * r - 2.0 * m) * bMinusA * bMinusA;
+        double inverseR2 = 1.0 / r2;
+        double pOverDelta = p / delta;
+        return {
+            radialVelocity,
+            (bigRPrime * r - 4.0 * bigR) * 0.5 * inverseR2 * inverseR2 / r,
+            (bMinusA + a * pOverDelta) * inverseR2,
+            (a * bMinusA + (r2 + a * a) * pOverDelta) * inverseR2
+        };
+    }
+    
+public:
+    explicit KerrPhotonEngine(double stepTolerance = 0.05, double minStep = 0.05, double maxStep = 40.0)
+        : stepTolerance(stepTolerance), minStep(minStep), maxStep(maxStep) {}
+    
+    static double horizonRadius(double m, double a) {
+        return m + std::sqrt(std::max(0.0, m * m - a * a));
+    }
+    
+    // Sets the constants of motion from a screen-space position and direction
+    void initialize(KerrPhoton& photon, const BlackHole& hole, const Vector2f& position, const Vector2f& velocity) const {
+        double m = hole.getGravitationalRadius();
+        double a = hole.getSpin() * m;
+        Vector2f relative = position - hole.getPosition();
+        Vector2f direction = velocity.normalized();
+        
+        photon.r = std::max(1e-3, static_cast<double>(relative.magnitude()));
+        photon.phi = std::atan2(relative.y, relative.x);
+        photon.t = 0;
+        photon.impactParameter = relative.cross(direction);
+        
+        double r = photon.r;
+        double b = photon.impactParameter;
+        double p = r * r + a * a - a * b;
+        double delta = r * r - 2.0 * m * r + a * a;
+        double bigR = p * p - delta * (b - a) * (b - a);
+        double speed = std::sqrt(std::max(0.0, bigR)) / (r * r);
+        photon.radialVelocity = relative.dot(direction) < 0 ? -speed : speed;
+        photon.initialized = true;
+        photon.captured = false;
+    }
+    
+    // Advances the photon by the given coordinate-time distance (pixels).
+    // Returns the number of substeps taken.
+    int advance(KerrPhoton& photon, const BlackHole& hole, double coordinateDistance) const {
+        double m = hole.getGravitationalRadius();
+        double a = hole.getSpin() * m;
+        double horizon = horizonRadius(m, a);
+        double b = photon.impactParameter;
+        double targetT = photon.t + coordinateDistance;
+        int substeps = 0;
+        
+        while (photon.t < targetT && !photon.captured) {
+            // Tuned step control: proportional to the distance from the horizon
+            double h = std::clamp(stepTolerance * (photon.r - horizon), minStep, maxStep);
+            
+            // Classic RK4 on (r, dr/dlambda, phi, t)
+            double r = photon.r, v = photon.radialVelocity;
+            Derivatives k1 = evaluate(r, v, b, m, a);
+            Derivatives k2 = evaluate(r + 0.5 * h * k1.r, v + 0.5 * h * k1.radialVelocity, b, m, a);
+            Derivatives k3 = evaluate(r + 0.5 * h * k2.r, v + 0.5 * h * k2.radialVelocity, b, m, a);
+            Derivatives k4 = evaluate(r + h * k3.r, v + h * k3.radialVelocity, b, m, a);
+            double dt = h / 6.0 * (k1.t + 2.0 * k2.t + 2.0 * k3.t + k4.t);
+            
+            // Shorten the last step so the frame ends on the target time
+            double fraction = 1.0;
+            if (photon.t + dt > targetT && dt > 0) fraction = (targetT - photon.t) / dt;
+            
+            photon.r += fraction * h / 6.0 * (k1.r + 2.0 * k2.r + 2.0 * k3.r + k4.r);
+            photon.radialVelocity += fraction * h / 6.0 * (k1.radialVelocity + 2.0 * k2.radialVelocity + 2.0 * k3.radialVelocity + k4.radialVelocity);
+            photon.phi += fraction * h / 6.0 * (k1.phi + 2.0 * k2.phi + 2.0 * k3.phi + k4.phi);
+            photon.t = fraction < 1.0 ? targetT : photon.t + dt;
+            substeps++;
+            
+            if (photon.r < horizon * 1.01) photon.captured = true;
+        }
+        return substeps;
+    }
+    
+    Vector2f position(const KerrPhoton& photon, const BlackHole& hole) const {
+        return hole.getPosition() + Vector2f(static_cast<float>(photon.r * std::cos(photon.phi)),
+                                             static_cast<float>(photon.r * std::sin(photon.phi)));
+    }
+    
+    // Screen-space velocity scaled to the simulation's light speed
+    Vector2f velocity(const KerrPhoton& photon, const BlackHole& hole) const {
+        double m = hole.getGravitationalRadius();
+        double a = hole.getSpin() * m;
+        Derivatives d = evaluate(photon.r, photon.radialVelocity, photon.impactParameter, m, a);
+        double c = std::cos(photon.phi), s = std::sin(photon.phi);
+        Vector2f v(static_cast<float>(d.r * c - photon.r * d.phi * s),
+                   static_cast<float>(d.r * s + photon.r * d.phi * c));
+        return v.normalized() * LIGHT_SPEED;
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Accretion disk ray marcher
+// ---------------------------------------------------------------------------
+
+struct Vector3d {
+    double x, y, z;
+    
+    constexpr Vector3d(double x = 0, double y = 0, double z = 0) : x(x), y(y), z(z) {}
+    constexpr Vector3d operator+(const Vector3d& o) const { return Vector3d(x + o.x, y + o.y, z + o.z); }
+    constexpr Vector3d operator-(const Vector3d& o) const { return Vector3d(x - o.x, y - o.y, z - o.z); }
+    constexpr Vector3d operator*(double s) const { return Vector3d(x * s, y * s, z * s); }
+    constexpr double dot(const Vector3d& o) const { return x * o.x + y * o.y + z * o.z; }
+    constexpr Vector3d cross(const Vector3d& o) const {
+        return Vector3d(y * o.z - z * o.y, z * o.x - x * o.z, x * o.y - y * o.x);
+    }
+    double magnitude() const { return std::sqrt(dot(*this)); }
+    Vector3d normalized() const {
+        double mag = magnitude();
+        return mag > 0 ? *this * (1.0 / mag) : Vector3d();
+    }
+};
+
+// Linear HDR radiance
+struct Radiance {
+    float r = 0, g = 0, b = 0;
+    
+    Radiance operator+(const Radiance& o) const { return {r + o.r, g + o.g, b + o.b}; }
+    Radiance operator*(float s) const { return {r * s, g * s, b * s}; }
+};
+
+// Geometrically thin Keplerian disk in the equatorial plane. Radii are in
+// units of the hole's gravitational radius M.
+struct AccretionDisk {
+    double innerRadius = 6.0;   // innermost stable circular orbit for a = 0
+    double outerRadius = 20.0;
+    float opacity = 0.95f;      // fraction of light absorbed per crossing
+    
+    // Novikov-Thorne-like profile T ~ r^-3/4 (1 - sqrt(rin / r))^1/4,
+    // normalized so the peak is about 1
+    double temperature(double r) const {
+        double profile = std::pow(r / innerRadius, -0.75) * std::pow(std::max(0.0, 1.0 - std::sqrt(innerRadius / r)), 0.25);
+        return profile / 0.488;
+    }
+};
+
+struct DiskCamera {
+    double distance = 375.0;               // pixels, 30 M for the default hole
+    double inclination = 80.0 * PI / 180;  // angle between view axis and disk normal
+    double fieldOfView = 50.0 * PI / 180;  // vertical
+};
+
+// Backward ray marcher for a Schwarzschild hole. Each pixel's photon moves
+// in the plane through the hole, so its orbit follows the Binet equation
+//   d2u/dphi2 = 3 M u^2 - u,   u = 1/r
+// integrated with RK4 in phi. Every crossing of the disk plane adds emission
+// scaled by g^4, where g combines gravitational redshift and Doppler
+// beaming of the orbiting gas; the march stops early once the photon falls
+// through the horizon or the remaining transmittance is negligible.
+class DiskRayMarcher {
+private:
+    AccretionDisk disk;
+    DiskCamera camera;
+    double gravitationalRadius = 12.5;  // M in pixels
+    int tileSize;
+    int width = 0;
+    int height = 0;
+    std::vector<sf::Uint8> pixels;
+    double lastRenderMilliseconds = 0;
+    
+    static Radiance blackbody(double t) {
+        // Cheap ramp from dull red through white to blue-white
+        float x = static_cast<float>(std::clamp(t, 0.0, 2.0));
+        return {std::min(1.0f, 0.6f + x),
+                std::clamp(x * 1.1f - 0.15f, 0.0f, 1.0f),
+                std::clamp(x * x * 0.7f - 0.1f, 0.0f, 1.2f)};
+    }
+    
+    // Faint celestial grid so escaping rays show the lensed sky
+    static Radiance sky(const Vector3d& direction) {
+        double longitude = std::atan2(direction.y, direction.x);
+        double latitude = std::asin(std::clamp(direction.z, -1.0, 1.0));
+        double lonLine = std::abs(std::remainder(longitude * 12.0 / (2.0 * PI), 1.0));
+        double latLine = std::abs(std::remainder(latitude * 12.0 / (2.0 * PI), 1.0));
+        float line = (lonLine < 0.03 || latLine < 0.03) ? 0.04f : 0.0f;
+        return {line, line, line * 1.4f};
+    }
+    
+public:
+    explicit DiskRayMarcher(const AccretionDisk& disk = AccretionDisk(), const DiskCamera& camera = DiskCamera(), int tileSize = 32)
+        : disk(disk), camera(camera), tileSize(tileSize) {}
+    
+    AccretionDisk& getDisk() { return disk; }
+    DiskCamera& getCamera() { return camera; }
+    
+    // Ties the image scale to a hole's mass: the camera sits at a fixed
+    // distance in pixels, so heavier holes look larger
+    void setHole(const BlackHole& hole) { gravitationalRadius = hole.getGravitationalRadius(); }
+    
+    // Radiance seen through image position (px, py) of a width x height frame
+    Radiance shade(double px, double py, int imageWidth, int imageHeight) const {
+        const double m = 1.0;
+        const double cameraDistance = camera.distance / gravitationalRadius;
+        const Vector3d normal(0, 0, 1);
+        Vector3d observer(0.0, -std::sin(camera.inclination), std::cos(camera.inclination));
+        Vector3d forward = observer * -1.0;
+        Vector3d up = (normal - forward * normal.dot(forward)).normalized();
+        Vector3d right = forward.cross(up);
+        
+        double tanHalf = std::tan(camera.fieldOfView * 0.5);
+        double sx = (2.0 * px / imageHeight - static_cast<double>(imageWidth) / imageHeight) * tanHalf;
+        double sy = (1.0 - 2.0 * py / imageHeight) * tanHalf;
+        Vector3d direction = (forward + right * sx + up * sy).normalized();
+        
+        // Orbit plane basis: e1 radial at the camera, e2 along the motion
+        Vector3d e1 = observer;
+        Vector3d tangential = direction - e1 * direction.dot(e1);
+        double sinAlpha = tangential.magnitude();
+        if (sinAlpha < 1e-9) return Radiance();  // straight into the hole
+        Vector3d e2 = tangential * (1.0 / sinAlpha);
+        double cosAlpha = direction.dot(e1);
+        
+        double u = 1.0 / cameraDistance;
+        double du = -u * cosAlpha / sinAlpha;
+        double impactParameter = cameraDistance * sinAlpha / std::sqrt(1.0 - 2.0 * m * u);
+        // z angular momentum of the physical photon, which travels towards -phi
+        double photonLz = -impactParameter * e1.cross(e2).dot(normal);
+        
+        Radiance color;
+        float transmittance = 1.0f;
+        double phi = 0.0;
+        double previousZ = cameraDistance * e1.dot(normal);
+        const double maxPhi = 6.0 * PI;
+        
+        while (phi < maxPhi) {
+            double h = std::clamp(0.12 * (1.0 - 2.0 * m * u), 0.01, 0.12);
+            
+            auto accel = [m](double uu) { return 3.0 * m * uu * uu - uu; };
+            double k1u = du, k1v = accel(u);
+            double k2u = du + 0.5 * h * k1v, k2v = accel(u + 0.5 * h * k1u);
+            double k3u = du + 0.5 * h * k2v, k3v = accel(u + 0.5 * h * k2u);
+            double k4u = du + h * k3v, k4v = accel(u + h * k3u);
+            double nextU = u + h / 6.0 * (k1u + 2.0 * k2u + 2.0 * k3u + k4u);
+            double nextDu = du + h / 6.0 * (k1v + 2.0 * k2v + 2.0 * k3v + k4v);
+            double nextPhi = phi + h;
+            
+            // Horizon capture ends the march
+            if (nextU >= 0.5 / m) return color;
+            
+            double nextZ = (std::cos(nextPhi) * e1.dot(normal) + std::sin(nextPhi) * e2.dot(normal)) / nextU;
+            if ((previousZ > 0) != (nextZ > 0)) {
+                double t = previousZ / (previousZ - nextZ);
+                double r = 1.0 / (u + t * (nextU - u));
+                if (r >= disk.innerRadius && r <= disk.outerRadius) {
+                    double omega = std::sqrt(m / (r * r * r));
+                    double g = std::sqrt(1.0 - 3.0 * m / r) / (1.0 - omega * photonLz);
+                    double emitted = disk.temperature(r);
+                    float intensity = static_cast<float>(std::pow(g, 4.0) * std::pow(emitted, 4.0));
+                    color = color + blackbody(g * emitted) * (intensity * disk.opacity * transmittance);
+                    transmittance *= 1.0f - disk.opacity;
+                    if (transmittance < 0.02f) return color;
+                }
+            }
+            
+            u = nextU;
+            du = nextDu;
+            phi = nextPhi;
+            previousZ = nextZ;
+            
+            // Escaped: heading outward beyond the camera sphere
+            if (du < 0 && u < 0.5 / cameraDistance) {
+                double drdphi = -du / (u * u);
+                Vector3d radial = e1 * std::cos(phi) + e2 * std::sin(phi);
+                Vector3d angular = e1 * -std::sin(phi) + e2 * std::cos(phi);
+                Vector3d outgoing = (radial * drdphi + angular * (1.0 / u)).normalized();
+                return color + sky(outgoing) * transmittance;
+            }
+        }
+        return color;
+    }
+    
+    static sf::Uint8 toneMap(float value) {
+        // Reinhard followed by a square-root display curve
+        float mapped = value / (1.0f + value);
+        return static_cast<sf::Uint8>(255.0f * std::sqrt(std::clamp(mapped, 0.0f, 1.0f)));
+    }
+    
+    // Renders a full frame, parallel over tiles with work stealing since
+    // tiles crossing the photon ring cost far more than empty sky
+    void render(WorkerPool& pool, int imageWidth, int imageHeight) {
+        auto start = std::chrono::steady_clock::now();
+        width = imageWidth;
+        height = imageHeight;
+        pixels.assign(static_cast<std::size_t>(width) * height * 4, 255);
+        int tilesX = (width + tileSize - 1) / tileSize;
+        int tilesY = (height + tileSize - 1) / tileSize;
+        
+        pool.parallelForDynamic(static_cast<std::size_t>(tilesX) * tilesY, 1, [&](std::size_t begin, std::size_t end, unsigned) {
+            for (std::size_t tile = begin; tile < end; tile++) {
+                int x0 = static_cast<int>(tile % tilesX) * tileSize;
+                int y0 = static_cast<int>(tile / tilesX) * tileSize;
+                for (int y = y0; y < std::min(y0 + tileSize, height); y++) {
+                    for (int x = x0; x < std::min(x0 + tileSize, width); x++) {
+                        Radiance c = shade(x + 0.5, y + 0.5, width, height);
+                        sf::Uint8* p = &pixels[(static_cast<std::size_t>(y) * width + x) * 4];
+                        p[0] = toneMap(c.r);
+                        p[1] = toneMap(c.g);
+                        p[2] = toneMap(c.b);
+                    }
+                }
+            }
+        });
+        
+        lastRenderMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    
+    const std::vector<sf::Uint8>& getPixels() const { return pixels; }
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    double getLastRenderMilliseconds() const { return lastRenderMilliseconds; }
+};
+
+// ---------------------------------------------------------------------------
+// Progressive lensed image rendering
+// ---------------------------------------------------------------------------
+
+// Refines a DiskRayMarcher image over many frames. restart() shades one
+// sample per coarse tile so a blocky image exists immediately; refine() then
+// splits tiles into quadrants, always taking the tiles whose samples
+// disagree most with their neighbours first (photon ring, Einstein ring,
+// disk edges) and leaving smooth sky for last. Refinement runs on the
+// calling thread; the time budget is checked before every chunk of shades,
+// and parents whose children were not all shaded go back on the queue.
+class ProgressiveRenderer {
+private:
+    struct Tile {
+        int x, y, size;
+        Radiance sample;
+        float priority;
+        
+        bool operator<(const Tile& other) const { return priority < other.priority; }
+    };
+    
+    DiskRayMarcher& marcher;
+    int width;
+    int height;
+    int coarseSize;
+    std::size_t batchSize;
+    std::vector<sf::Uint8> pixels;
+    std::priority_queue<Tile> queue;
+    double sceneRadius = -1.0;
+    DiskCamera sceneCamera;
+    AccretionDisk sceneDisk;
+    std::size_t finalPixels = 0;
+    
+    static float disagreement(const Radiance& a, const Radiance& b) {
+        return std::max({std::abs(a.r - b.r), std::abs(a.g - b.g), std::abs(a.b - b.b)});
+    }
+    
+    static float priorityFor(float difference, int size) {
+        // The small floor lets smooth regions refine once nothing else is left
+        return (difference + 0.01f) * static_cast<float>(size) * static_cast<float>(size);
+    }
+    
+    void fill(const Tile& tile) {
+        sf::Uint8 r = DiskRayMarcher::toneMap(tile.sample.r);
+        sf::Uint8 g = DiskRayMarcher::toneMap(tile.sample.g);
+        sf::Uint8 b = DiskRayMarcher::toneMap(tile.sample.b);
+        for (int y = tile.y; y < std::min(tile.y + tile.size, height); y++) {
+            for (int x = tile.x; x < std::min(tile.x + tile.size, width); x++) {
+                sf::Uint8* p = &pixels[(static_cast<std::size_t>(y) * width + x) * 4];
+                p[0] = r;
+                p[1] = g;
+                p[2] = b;
+            }
+        }
+    }
+    
+    Radiance sampleTile(int x, int y, int size) const {
+        double cx = size > 1 ? x + size * 0.5 : x + 0.5;
+        double cy = size > 1 ? y + size * 0.5 : y + 0.5;
+        return marcher.shade(cx, cy, width, height);
+    }
+    
+public:
+    ProgressiveRenderer(DiskRayMarcher& marcher, int width, int height, int coarseSize = 16, std::size_t batchSize = 512)
+        : marcher(marcher), width(width), height(height), coarseSize(coarseSize), batchSize(batchSize),
+          pixels(static_cast<std::size_t>(width) * height * 4, 255) {}
+    
+    // Restarts when anything the image depends on changed: the hole's mass,
+    // the camera or the disk. The hole's screen position and spin do not
+    // matter because the marcher is camera-centred and Schwarzschild-only.
+    bool restartIfChanged(WorkerPool& pool, const BlackHole& hole) {
+        const DiskCamera& camera = marcher.getCamera();
+        const AccretionDisk& disk = marcher.getDisk();
+        if (hole.getGravitationalRadius() == sceneRadius &&
+            camera.distance == sceneCamera.distance && camera.inclination == sceneCamera.inclination &&
+            camera.fieldOfView == sceneCamera.fieldOfView && disk.innerRadius == sceneDisk.innerRadius &&
+            disk.outerRadius == sceneDisk.outerRadius && disk.opacity == sceneDisk.opacity) {
+            return false;
+        }
+        sceneRadius = hole.getGravitationalRadius();
+        sceneCamera = camera;
+        sceneDisk = disk;
+        marcher.setHole(hole);
+        restart(pool);
+        return true;
+    }
+    
+    void restart(WorkerPool& pool) {
+        queue = std::priority_queue<Tile>();
+        finalPixels = 0;
+        
+        int tilesX = (width + coarseSize - 1) / coarseSize;
+        int tilesY = (height + coarseSize - 1) / coarseSize;
+        std::vector<Tile> coarse(static_cast<std::size_t>(tilesX) * tilesY);
+        pool.parallelForDynamic(coarse.size(), 64, [&](std::size_t begin, std::size_t end, unsigned) {
+            for (std::size_t i = begin; i < end; i++) {
+                int x = static_cast<int>(i % tilesX) * coarseSize;
+                int y = static_cast<int>(i / tilesX) * coarseSize;
+                coarse[i] = {x, y, coarseSize, sampleTile(x, y, coarseSize), 0.0f};
+            }
+        });
+        
+        for (std::size_t i = 0; i < coarse.size(); i++) {
+            int tx = static_cast<int>(i % tilesX), ty = static_cast<int>(i / tilesX);
+            float difference = 0.0f;
+            if (tx + 1 < tilesX) difference = std::max(difference, disagreement(coarse[i].sample, coarse[i + 1].sample));
+            if (tx > 0) difference = std::max(difference, disagreement(coarse[i].sample, coarse[i - 1].sample));
+            if (ty + 1 < tilesY) difference = std::max(difference, disagreement(coarse[i].sample, coarse[i + tilesX].sample));
+            if (ty > 0) difference = std::max(difference, disagreement(coarse[i].sample, coarse[i - tilesX].sample));
+            coarse[i].priority = priorityFor(difference, coarseSize);
+            fill(coarse[i]);
+            queue.push(coarse[i]);
+        }
+    }
+    
+    // Splits the most promising tiles until the time budget is spent.
+    // Returns false once the image is complete.
+    bool refine(WorkerPool& pool, double budgetMilliseconds) {
+        auto start = std::chrono::steady_clock::now();
+        while (!queue.empty()) {
+            double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            if (elapsed >= budgetMilliseconds) break;
+            
+            std::vector<Tile> parents;
+            while (!queue.empty() && parents.size() < batchSize) {
+                parents.push_back(queue.top());
+                queue.pop();
+            }
+            std::vector<Tile> children;
+            std::vector<std::size_t> firstChild;
+            for (const Tile& parent : parents) {
+                firstChild.push_back(children.size());
+                int half = parent.size / 2;
+                for (int q = 0; q < 4; q++) {
+                    int x = parent.x + (q % 2) * half;
+                    int y = parent.y + (q / 2) * half;
+                    if (x < width && y < height) children.push_back({x, y, half, Radiance(), 0.0f});
+                }
+            }
+            firstChild.push_back(children.size());
+            
+            // Shades cost microseconds, so checking the clock per 16-shade
+            // chunk keeps the overrun far below the budget
+            std::vector<unsigned char> shaded(children.size(), 0);
+            std::atomic<bool> expired{false};
+            pool.parallelForDynamic(children.size(), 16, [&](std::size_t begin, std::size_t end, unsigned) {
+                if (expired.load(std::memory_order_relaxed)) return;
+                if (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() >= budgetMilliseconds) {
+                    expired.store(true, std::memory_order_relaxed);
+                    return;
+                }
+                for (std::size_t i = begin; i < end; i++) {
+                    children[i].sample = sampleTile(children[i].x, children[i].y, children[i].size);
+                    shaded[i] = 1;
+                }
+            });
+            
+            for (std::size_t p = 0; p < parents.size(); p++) {
+                bool complete = true;
+                for (std::size_t i = firstChild[p]; i < firstChild[p + 1]; i++) complete = complete && shaded[i];
+                if (!complete) {
+                    queue.push(parents[p]);
+                    continue;
+                }
+                for (std::size_t i = firstChild[p]; i < firstChild[p + 1]; i++) {
+                    Tile& tile = children[i];
+                    fill(tile);
+                    if (tile.size <= 1) {
+                        finalPixels++;
+                        continue;
+                    }
+                    float difference = disagreement(tile.sample, parents[p].sample);
+                    for (std::size_t j = firstChild[p]; j < firstChild[p + 1]; j++) {
+                        difference = std::max(difference, disagreement(tile.sample, children[j].sample));
+                    }
+                    tile.priority = priorityFor(difference, tile.size);
+                    queue.push(tile);
+                }
+            }
+        }
+        return !queue.empty();
+    }
+    
+    const std::vector<sf::Uint8>& getPixels() const { return pixels; }
+    float getProgress() const { return static_cast<float>(finalPixels) / (static_cast<float>(width) * height); }
+};
+
+// ---------------------------------------------------------------------------
+// Lensed background with a reprojection cache
+// ---------------------------------------------------------------------------
+
+// Per-pixel deflection of the background by a single hole, cached for
+// interactive dragging. Because the lens is radially symmetric, a pixel's
+// result depends only on its offset from the hole, so the cache is indexed
+// by that offset in a toroidal buffer the size of the screen. Moving the hole
+// by (dx, dy) slides the screen window over the buffer: every overlapping
+// entry is reused as is and only the newly exposed strips are recomputed.
+// Changing the mass (or jumping further than a screen) needs every sample;
+// that rebuild fills spare buffers a span at a time within a per-call time
+// budget while the previous field stays live, follows the hole with the
+// same strips if it moves meanwhile, and is swapped in once it catches up.
+//
+// Rays are integrated only along a radial profile every quarter pixel, each
+// carrying its differential with respect to the impact parameter; pixels
+// interpolate deflection and derivative from that profile, which puts every
+// pixel's footprint in the source plane. Only the thin ring next to the
+// photon sphere integrates per pixel. The renderer filters the background
+// over that footprint and supersamples only where it is large.
+class DeflectionCache {
+public:
+    // Bending angle and its derivative with respect to the impact parameter
+    struct Deflection {
+        float alpha;
+        float slope;
+    };
+    
+private:
+    static constexpr float PROFILE_STEP = 0.25f;    // pixels between radial profile samples
+    // Impact parameter, in gravitational radii, below which samples integrate
+    // exactly: the bending diverges logarithmically towards the critical
+    // 3 sqrt(3) and a cubic across a profile step misses it by up to 90 px
+    static constexpr float EXACT_IMPACT = 5.3f;
+    
+    int width;
+    int height;
+    float lensScale;  // pixels of source-plane shift per radian of deflection
+    std::vector<Vector2f> offsets;  // source position minus pixel; NaN when captured
+    std::vector<Vector2f> footprints;  // source-plane extent of the pixel along x and y
+    std::vector<Deflection> profile;   // deflection every PROFILE_STEP px from the hole, for subsamples
+    int originX = 0;  // hole-relative coordinates of screen pixel (0, 0)
+    int originY = 0;
+    float cachedMass = -1.0f;
+    float gravitationalRadius = 1.0f;
+    std::size_t lastRecomputed = 0;
+    double lastUpdateMilliseconds = 0;
+    
+    // Hole-relative rectangle [u0, u1) x [v0, v1)
+    struct Region {
+        int u0, u1, v0, v1;
+        std::size_t area() const { return static_cast<std::size_t>(u1 - u0) * (v1 - v0); }
+    };
+    
+    // Full rebuild in progress, filling the spare buffers: the profile first,
+    // then the queued regions, which cover the screen at (originX, originY)
+    struct Rebuild {
+        bool active = false;
+        float mass = 0.0f;
+        float gravitationalRadius = 1.0f;
+        int originX = 0;
+        int originY = 0;
+        std::size_t nextProfile = 0;
+        std::vector<Region> regions;
+        std::size_t nextPixel = 0;  // within regions.back()
+        std::size_t done = 0;
+        std::size_t total = 0;
+        std::vector<Vector2f> offsets;
+        std::vector<Vector2f> footprints;
+        std::vector<Deflection> profile;
+    } rebuild;
+    
+    std::size_t wrap(int u, int v) const {
+        int x = ((u % width) + width) % width;
+        int y = ((v % height) + height) % height;
+        return static_cast<std::size_t>(y) * width + x;
+    }
+    
+    // Total bending angle for impact parameter b (units of M), integrating
+    // the Binet equation from infinity back to infinity; NaN if captured.
+    // The tangent (du/db, du'/db) is stepped with the same RK4 stages, and
+    // the exit angle moves by -(du/db) / u' per unit b when u returns to 0.
+    static Deflection deflection(double b) {
+        const double criticalImpact = 3.0 * std::sqrt(3.0);
+        if (b <= criticalImpact) return {std::nanf(""), std::nanf("")};
+        double u = 0.0, du = 1.0 / b, phi = 0.0;
+        double tu = 0.0, tdu = -1.0 / (b * b);
+        double h = std::clamp(0.02 * (b - criticalImpact), 0.002, 0.02);
+        auto accel = [](double uu) { return 3.0 * uu * uu - uu; };
+        auto tangentAccel = [](double uu, double tuu) { return (6.0 * uu - 1.0) * tuu; };
+        while (true) {
+            double k1u = du, k1v = accel(u);
+            double k2u = du + 0.5 * h * k1v, k2v = accel(u + 0.5 * h * k1u);
+            double k3u = du + 0.5 * h * k2v, k3v = accel(u + 0.5 * h * k2u);
+            double k4u = du + h * k3v, k4v = accel(u + h * k3u);
+            double j1u = tdu, j1v = tangentAccel(u, tu);
+            double j2u = tdu + 0.5 * h * j1v, j2v = tangentAccel(u + 0.5 * h * k1u, tu + 0.5 * h * j1u);
+            double j3u = tdu + 0.5 * h * j2v, j3v = tangentAccel(u + 0.5 * h * k2u, tu + 0.5 * h * j2u);
+            double j4u = tdu + h * j3v, j4v = tangentAccel(u + h * k3u, tu + h * j3u);
+            double nextU = u + h / 6.0 * (k1u + 2.0 * k2u + 2.0 * k3u + k4u);
+            double nextTu = tu + h / 6.0 * (j1u + 2.0 * j2u + 2.0 * j3u + j4u);
+            double nextDu = du + h / 6.0 * (k1v + 2.0 * k2v + 2.0 * k3v + k4v);
+            double nextTdu = tdu + h / 6.0 * (j1v + 2.0 * j2v + 2.0 * j3v + j4v);
+            if (nextU <= 0.0) {
+                double t = u / (u - nextU);
+                phi += h * t;
+                double exitTu = tu + t * (nextTu - tu);
+                double exitDu = du + t * (nextDu - du);
+                return {static_cast<float>(phi - PI), static_cast<float>(-exitTu / exitDu)};
+            }
+            if (nextU >= 0.5) return {std::nanf(""), std::nanf("")};
+            u = nextU;
+            du = nextDu;
+            tu = nextTu;
+            tdu = nextTdu;
+            phi += h;
+        }
+    }
+    
+    // Source-plane offset for a hole-relative position at the given deflection
+    Vector2f offsetFor(Vector2f relative, float distance, float alpha) const {
+        // Thin-lens mapping: the source sits alpha * lensScale closer to the hole
+        return relative * (-alpha * lensScale / distance);
+    }
+    
+    // Deflection at a distance in pixels from the hole, Hermite-interpolated
+    // from a radial profile with its propagated slopes; the slope is the
+    // derivative of the same cubic. Next to the critical impact parameter and
+    // beyond the table it integrates exactly.
+    static Deflection profileDeflection(const std::vector<Deflection>& table, float distance, float m) {
+        float position = distance / PROFILE_STEP;
+        std::size_t i = static_cast<std::size_t>(position);
+        if (distance >= EXACT_IMPACT * m && i + 1 < table.size() &&
+            !std::isnan(table[i].alpha) && !std::isnan(table[i + 1].alpha)) {
+            float t = position - i;
+            float t2 = t * t, t3 = t2 * t;
+            // Slopes per profile step rather than per unit impact parameter
+            float scale = PROFILE_STEP / m;
+            float s0 = table[i].slope * scale, s1 = table[i + 1].slope * scale;
+            float alpha = (2 * t3 - 3 * t2 + 1) * table[i].alpha + (t3 - 2 * t2 + t) * s0 +
+                          (-2 * t3 + 3 * t2) * table[i + 1].alpha + (t3 - t2) * s1;
+            float slope = (6 * t2 - 6 * t) * (table[i].alpha - table[i + 1].alpha) + (3 * t2 - 4 * t + 1) * s0 +
+                          (3 * t2 - 2 * t) * s1;
+            return {alpha, slope / scale};
+        }
+        if (distance < 1e-3f) return {std::nanf(""), std::nanf("")};
+        return deflection(distance / m);
+    }
+    
+    void computeSample(int u, int v, float m, const std::vector<Deflection>& table, Vector2f& offset, Vector2f& footprint) const {
+        Vector2f relative(static_cast<float>(u), static_cast<float>(v));
+        float distance = relative.magnitude();
+        Deflection d = profileDeflection(table, distance, m);
+        if (std::isnan(d.alpha)) {
+            offset = footprint = Vector2f(std::nanf(""), std::nanf(""));
+            return;
+        }
+        offset = offsetFor(relative, distance, d.alpha);
+        // Jacobian of the pixel -> source map: stretch along the radius and
+        // across it, J = tangential * I + (radial - tangential) * n n^T
+        float radial = 1.0f - lensScale * d.slope / m;
+        float tangential = 1.0f - lensScale * d.alpha / distance;
+        Vector2f n = relative * (1.0f / distance);
+        float difference = radial - tangential;
+        float jxx = tangential + difference * n.x * n.x;
+        float jxy = difference * n.x * n.y;
+        float jyy = tangential + difference * n.y * n.y;
+        footprint = Vector2f(std::abs(jxx) + std::abs(jxy), std::abs(jxy) + std::abs(jyy));
+    }
+    
+    // Regions that come into view when the screen's hole-relative origin
+    // moves from (fromX, fromY) to (toX, toY); the whole screen past a jump
+    std::vector<Region> exposedRegions(int fromX, int fromY, int toX, int toY) const {
+        int dx = toX - fromX;
+        int dy = toY - fromY;
+        if (std::abs(dx) >= width || std::abs(dy) >= height) return {{toX, toX + width, toY, toY + height}};
+        std::vector<Region> regions;
+        // Columns that scrolled into view, over the full new height
+        if (dx > 0) regions.push_back({fromX + width, toX + width, toY, toY + height});
+        if (dx < 0) regions.push_back({toX, fromX, toY, toY + height});
+        // Rows that scrolled into view, excluding the columns done above
+        int keepU0 = std::max(fromX, toX);
+        int keepU1 = std::min(fromX, toX) + width;
+        if (dy > 0) regions.push_back({keepU0, keepU1, fromY + height, toY + height});
+        if (dy < 0) regions.push_back({keepU0, keepU1, toY, fromY});
+        return regions;
+    }
+    
+    void computeRegion(WorkerPool& pool, const Region& region, float m) {
+        if (region.u0 >= region.u1 || region.v0 >= region.v1) return;
+        pool.parallelForDynamic(static_cast<std::size_t>(region.v1 - region.v0), 4, [&](std::size_t begin, std::size_t end, unsigned) {
+            for (std::size_t row = begin; row < end; row++) {
+                int v = region.v0 + static_cast<int>(row);
+                for (int u = region.u0; u < region.u1; u++) {
+                    std::size_t i = wrap(u, v);
+                    computeSample(u, v, m, profile, offsets[i], footprints[i]);
+                }
+            }
+        });
+        lastRecomputed += region.area();
+    }
+    
+    void startRebuild(float mass, float m, int newOriginX, int newOriginY) {
+        rebuild.active = true;
+        rebuild.mass = mass;
+        rebuild.gravitationalRadius = m;
+        rebuild.originX = newOriginX;
+        rebuild.originY = newOriginY;
+        rebuild.nextProfile = 0;
+        rebuild.regions = {{newOriginX, newOriginX + width, newOriginY, newOriginY + height}};
+        rebuild.nextPixel = 0;
+        rebuild.done = 0;
+        rebuild.offsets.resize(offsets.size());
+        rebuild.footprints.resize(footprints.size());
+        // Deflection against distance from the hole, covering the screen diagonal
+        float reach = std::sqrt(static_cast<float>(width) * width + static_cast<float>(height) * height);
+        rebuild.profile.resize(static_cast<std::size_t>(reach / PROFILE_STEP) + 2);
+        rebuild.total = rebuild.profile.size() + offsets.size();
+    }
+    
+    // Advances the rebuild towards the screen at (targetX, targetY) a span at
+    // a time until the budget is spent; returns true once it covers it. A
+    // span is 64 samples per worker, about a millisecond even next to the
+    // shadow where rays orbit longest, so the budget is overrun by at most that.
+    bool advanceRebuild(WorkerPool& pool, int targetX, int targetY,
+                        std::chrono::steady_clock::time_point start, double budgetMilliseconds) {
+        const std::size_t span = 64 * pool.size();
+        const float m = rebuild.gravitationalRadius;
+        auto expired = [&] {
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() >= budgetMilliseconds;
+        };
+        while (rebuild.nextProfile < rebuild.profile.size()) {
+            if (expired()) return false;
+            std::size_t first = rebuild.nextProfile;
+            std::size_t last = std::min(first + span, rebuild.profile.size());
+            pool.parallelForDynamic(last - first, 16, [&](std::size_t begin, std::size_t end, unsigned) {
+                for (std::size_t i = first + begin; i < first + end; i++) {
+                    rebuild.profile[i] = i == 0 ? Deflection{std::nanf(""), std::nanf("")} : deflection(i * PROFILE_STEP / m);
+                }
+            });
+            rebuild.done += last - first;
+            rebuild.nextProfile = last;
+        }
+        while (true) {
+            if (rebuild.regions.empty()) {
+                if (rebuild.originX == targetX && rebuild.originY == targetY) return true;
+                // The hole moved since the rebuild started: queue the strips
+                // that scrolled into view, as a drag would
+                rebuild.regions = exposedRegions(rebuild.originX, rebuild.originY, targetX, targetY);
+                for (const Region& region : rebuild.regions) rebuild.total += region.area();
+                rebuild.originX = targetX;
+                rebuild.originY = targetY;
+                rebuild.nextPixel = 0;
+                continue;
+            }
+            const Region region = rebuild.regions.back();
+            if (rebuild.nextPixel >= region.area()) {
+                rebuild.regions.pop_back();
+                rebuild.nextPixel = 0;
+                continue;
+            }
+            if (expired()) return false;
+            std::size_t first = rebuild.nextPixel;
+            std::size_t last = std::min(first + span, region.area());
+            const int regionWidth = region.u1 - region.u0;
+            pool.parallelForDynamic(last - first, 16, [&](std::size_t begin, std::size_t end, unsigned) {
+                for (std::size_t p = first + begin; p < first + end; p++) {
+                    int u = region.u0 + static_cast<int>(p % regionWidth);
+                    int v = region.v0 + static_cast<int>(p / regionWidth);
+                    std::size_t i = wrap(u, v);
+                    computeSample(u, v, m, rebuild.profile, rebuild.offsets[i], rebuild.footprints[i]);
+                }
+            });
+            rebuild.done += last - first;
+            rebuild.nextPixel = last;
+            lastRecomputed += last - first;
+        }
+    }
+    
+public:
+    DeflectionCache(int width, int height, float lensScale = 200.0f)
+        : width(width), height(height), lensScale(lensScale),
+          offsets(static_cast<std::size_t>(width) * height),
+          footprints(static_cast<std::size_t>(width) * height) {}
+    
+    // Brings the cache in line with the hole; returns true if the live field
+    // changed. A full rebuild spends at most about budgetMilliseconds per
+    // call and keeps serving the previous field until it completes; the
+    // default budget finishes it within the call.
+    bool update(WorkerPool& pool, const BlackHole& hole,
+                double budgetMilliseconds = std::numeric_limits<double>::infinity()) {
+        int newOriginX = -static_cast<int>(std::lround(hole.getPosition().x));
+        int newOriginY = -static_cast<int>(std::lround(hole.getPosition().y));
+        float m = hole.getGravitationalRadius();
+        bool full = hole.getMass() != cachedMass || std::abs(newOriginX - originX) >= width ||
+                    std::abs(newOriginY - originY) >= height;
+        // Back within reach of the live field before a rebuild finished
+        if (!full) rebuild.active = false;
+        if (!full && newOriginX == originX && newOriginY == originY) return false;
+        
+        auto start = std::chrono::steady_clock::now();
+        lastRecomputed = 0;
+        if (full) {
+            if (!rebuild.active || rebuild.mass != hole.getMass()) startRebuild(hole.getMass(), m, newOriginX, newOriginY);
+            if (!advanceRebuild(pool, newOriginX, newOriginY, start, budgetMilliseconds)) {
+                lastUpdateMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                return false;
+            }
+            offsets.swap(rebuild.offsets);
+            footprints.swap(rebuild.footprints);
+            profile.swap(rebuild.profile);
+            cachedMass = rebuild.mass;
+            gravitationalRadius = rebuild.gravitationalRadius;
+            rebuild.active = false;
+        } else {
+            for (const Region& region : exposedRegions(originX, originY, newOriginX, newOriginY)) {
+                computeRegion(pool, region, m);
+            }
+        }
+        originX = newOriginX;
+        originY = newOriginY;
+        lastUpdateMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return true;
+    }
+    
+    // True once a field has been built; before that there is nothing to show
+    bool isReady() const { return cachedMass >= 0.0f; }
+    // Fraction of a full rebuild done, or 1 when none is in progress
+    float getRebuildProgress() const {
+        if (!rebuild.active) return 1.0f;
+        return static_cast<float>(rebuild.done) / static_cast<float>(rebuild.total);
+    }
+    
+    // Source-plane offset seen through screen pixel (x, y)
+    Vector2f offsetAt(int x, int y) const { return offsets[wrap(originX + x, originY + y)]; }
+    // Source-plane extent of screen pixel (x, y) along x and y; NaN when captured
+    Vector2f footprintAt(int x, int y) const { return footprints[wrap(originX + x, originY + y)]; }
+    
+    // Source-plane offset at a subpixel position, Hermite-interpolated from
+    // the radial profile using the propagated slope
+    Vector2f offsetAtSubpixel(float x, float y) const {
+        Vector2f relative(originX + x, originY + y);
+        float distance = relative.magnitude();
+        Deflection d = profileDeflection(profile, distance, gravitationalRadius);
+        if (std::isnan(d.alpha)) return Vector2f(d.alpha, d.alpha);
+        return offsetFor(relative, distance, d.alpha);
+    }
+    
+    std::size_t getLastRecomputed() const { return lastRecomputed; }
+    double getLastUpdateMilliseconds() const { return lastUpdateMilliseconds; }
+};
+
+// Fraction of [a, b] covered by a periodic pulse train with the given period
+// that is on over [0, width) of each period (box filter of the pattern)
+inline float pulseCoverage(float a, float b, float period, float width) {
+    auto integral = [&](float t) {
+        float cycles = std::floor(t / period);
+        return cycles * width + std::min(t - cycles * period, width);
+    };
+    return (integral(b) - integral(a)) / (b - a);
+}
+
+// The reference grid at source position (sx, sy), box-filtered over a
+// footprint of wx by wy source pixels: the same 50 px lines as drawGrid over
+// a faint 100 px checkerboard
+inline void shadeLensedGrid(float sx, float sy, float wx, float wy, float rgb[3]) {
+    wx = std::max(wx, 1e-3f);
+    wy = std::max(wy, 1e-3f);
+    // Lines are 2 px wide, centred on multiples of 50
+    float lineX = pulseCoverage(sx + 1.0f - 0.5f * wx, sx + 1.0f + 0.5f * wx, 50.0f, 2.0f);
+    float lineY = pulseCoverage(sy + 1.0f - 0.5f * wy, sy + 1.0f + 0.5f * wy, 50.0f, 2.0f);
+    float line = 1.0f - (1.0f - lineX) * (1.0f - lineY);
+    // Odd 100 px cells along each axis, combined as an exclusive or
+    float oddX = pulseCoverage(sx - 100.0f - 0.5f * wx, sx - 100.0f + 0.5f * wx, 200.0f, 100.0f);
+    float oddY = pulseCoverage(sy - 100.0f - 0.5f * wy, sy - 100.0f + 0.5f * wy, 200.0f, 100.0f);
+    float checker = oddX * (1.0f - oddY) + oddY * (1.0f - oddX);
+    float base = 10.0f + 8.0f * checker;
+    rgb[0] = rgb[1] = base + (70.0f - base) * line;
+    rgb[2] = base + 6.0f + (84.0f - base) * line;
+}
+
+// Pixels whose source footprint exceeds this many source pixels along an
+// axis are supersampled; below it the box filter alone is accurate
+constexpr float SUPERSAMPLE_FOOTPRINT = 2.0f;
+constexpr int MAX_SUPERSAMPLES = 4;     // per axis
+
+struct LensedRenderStats {
+    std::size_t supersampledPixels = 0;
+    std::size_t samples = 0;
+};
+
+// Shades the reference grid as seen through the cached deflection field.
+// Each pixel is filtered over its ray-differential footprint and only pixels
+// with a large footprint (strong differential lensing near the shadow) take
+// extra samples. uniformSamples > 0 forces that many samples per axis
+// everywhere instead, as a reference.
+LensedRenderStats renderLensedBackground(WorkerPool& pool, const DeflectionCache& cache, int width, int height,
+                                         std::vector<sf::Uint8>& pixels, int uniformSamples = 0) {
+    pixels.resize(static_cast<std::size_t>(width) * height * 4);
+    std::vector<LensedRenderStats> perWorker(pool.size());
+    pool.parallelFor(static_cast<std::size_t>(height), [&](std::size_t begin, std::size_t end, unsigned worker) {
+        LensedRenderStats& stats = perWorker[worker];
+        for (std::size_t y = begin; y < end; y++) {
+            for (int x = 0; x < width; x++) {
+                Vector2f offset = cache.offsetAt(x, static_cast<int>(y));
+                Vector2f footprint = cache.footprintAt(x, static_cast<int>(y));
+                sf::Uint8* p = &pixels[(y * width + x) * 4];
+                p[3] = 255;
+                float extent = std::max(footprint.x, footprint.y);
+                int n = uniformSamples;
+                if (n == 0 && extent > SUPERSAMPLE_FOOTPRINT) {
+                    n = std::min(MAX_SUPERSAMPLES, static_cast<int>(std::ceil(extent / SUPERSAMPLE_FOOTPRINT)) + 1);
+                }
+                if (n <= 1) {
+                    stats.samples++;
+                    if (std::isnan(offset.x)) {
+                        p[0] = p[1] = p[2] = 0;
+                        continue;
+                    }
+                    float rgb[3];
+                    shadeLensedGrid(x + offset.x, y + offset.y, footprint.x, footprint.y, rgb);
+                    for (int c = 0; c < 3; c++) p[c] = static_cast<sf::Uint8>(rgb[c] + 0.5f);
+                    continue;
+                }
+                
+                // Stratified subsamples, each filtered over its share of the
+                // footprint; captured subsamples contribute black
+                stats.supersampledPixels++;
+                stats.samples += n * n;
+                float sum[3] = {0.0f, 0.0f, 0.0f};
+                float wx = std::isnan(footprint.x) ? 1.0f : footprint.x / n;
+                float wy = std::isnan(footprint.y) ? 1.0f : footprint.y / n;
+                for (int j = 0; j < n; j++) {
+                    for (int i = 0; i < n; i++) {
+                        float sx = x - 0.5f + (i + 0.5f) / n;
+                        float sy = y - 0.5f + (j + 0.5f) / n;
+                        Vector2f sub = cache.offsetAtSubpixel(sx, sy);
+                        if (std::isnan(sub.x)) continue;
+                        float rgb[3];
+                        shadeLensedGrid(sx + sub.x, sy + sub.y, wx, wy, rgb);
+                        for (int c = 0; c < 3; c++) sum[c] += rgb[c];
+                    }
+                }
+                for (int c = 0; c < 3; c++) p[c] = static_cast<sf::Uint8>(sum[c] / (n * n) + 0.5f);
+            }
+        }
+    });
+    LensedRenderStats total;
+    for (const LensedRenderStats& stats : perWorker) {
+        total.supersampledPixels += stats.supersampledPixels;
+        total.samples += stats.samples;
+    }
+    return total;
+}
+
+// ---------------------------------------------------------------------------
+// Optional per-ray accumulators
+// ---------------------------------------------------------------------------
+
+// Build with -DBH_TRACK_SHAPIRO_DELAY=1 and/or -DBH_TRACK_REDSHIFT=1 to fuse
+// these accumulators into the ray kernels. Disabled accumulators are empty
+// bases with no-op members, so they cost neither storage nor instructions.
+#ifndef BH_TRACK_SHAPIRO_DELAY
+#define BH_TRACK_SHAPIRO_DELAY 0
+#endif
+#ifndef BH_TRACK_REDSHIFT
+#define BH_TRACK_REDSHIFT 0
+#endif
+
+constexpr bool TRACK_SHAPIRO_DELAY = BH_TRACK_SHAPIRO_DELAY != 0;
+constexpr bool TRACK_REDSHIFT = BH_TRACK_REDSHIFT != 0;
+
+// Weak-field Shapiro delay: each step adds 2GM/(c^2 r) * dt of extra
+// arrival time, one multiply-add given 1/r from the kernel
+struct ShapiroDelayAccumulator {
+    float shapiroDelay = 0.0f;  // seconds
+    
+    void accumulateShapiro(float twoMDeltaTime, float inverseDistance) {
+        shapiroDelay += twoMDeltaTime * inverseDistance;
+    }
+    float shapiroDelaySeconds() const { return shapiroDelay; }
+};
+
+struct NoShapiroDelay {
+    void accumulateShapiro(float, float) {}
+    float shapiroDelaySeconds() const { return 0.0f; }
+};
+
+// Gravitational frequency shift relative to the emission point for static
+// observers: ln(nu / nu_emit) = M/r - M/r_emit in the weak field
+struct RedshiftAccumulator {
+    float emissionPotential = -1.0f;  // M / r_emit; negative until emitted
+    float potential = 0.0f;           // M / r after the latest step
+    
+    bool needsEmission() const { return emissionPotential < 0; }
+    void emitRedshift(float m, float inverseDistance) { emissionPotential = potential = m * inverseDistance; }
+    void inheritRedshift(float emission) { emissionPotential = potential = emission; }
+    float emissionPotentialValue() const { return emissionPotential; }
+    void accumulateRedshift(float m, float inverseDistance) { potential = m * inverseDistance; }
+    // z = nu_emit / nu - 1
+    float redshiftZ() const {
+        return emissionPotential < 0 ? 0.0f : std::exp(emissionPotential - potential) - 1.0f;
+    }
+};
+
+struct NoRedshift {
+    bool needsEmission() const { return false; }
+    void emitRedshift(float, float) {}
+    void inheritRedshift(float) {}
+    float emissionPotentialValue() const { return -1.0f; }
+    void accumulateRedshift(float, float) {}
+    float redshiftZ() const { return 0.0f; }
+};
+
+using ShapiroDelayFeature = std::conditional_t<TRACK_SHAPIRO_DELAY, ShapiroDelayAccumulator, NoShapiroDelay>;
+using RedshiftFeature = std::conditional_t<TRACK_REDSHIFT, RedshiftAccumulator, NoRedshift>;
+
+class LightRay : private ShapiroDelayFeature, private RedshiftFeature {
+private:
+    RayPath path;
+    Vector2f currentPosition;
+    Vector2f currentVelocity;
+    sf::Color color;
+    float impactParameter;
+    float age;                  // seconds since spawn, stamps trail points
+    bool absorbed;
+    
+public:
+    LightRay(Vector2f startPos, Vector2f initialVel, sf::Color c)
+        : LightRay(startPos, initialVel, c, pathStorage(), trailWindow()) {}
+    
+    // Ray whose trajectory uses the given storage and trail window instead
+    // of the process-wide defaults
+    LightRay(Vector2f startPos, Vector2f initialVel, sf::Color c, PathStorage storage, const TrailWindow& trail)
+        : path(storage, trail), currentPosition(startPos), currentVelocity(initialVel), color(c), age(0), absorbed(false) {
+        path.push_back(startPos);
+        // Impact parameter is the perpendicular distance from the trajectory to the black hole
+        impactParameter = std::abs(startPos.y - WINDOW_HEIGHT / 2.0f);
+    }
+    
+    // Ray created mid-flight, e.g. interpolated between wavefront neighbours
+    LightRay(Vector2f startPos, Vector2f initialVel, sf::Color c, float impactParameter)
+        : currentPosition(startPos), currentVelocity(initialVel), color(c),
+          impactParameter(impactParameter), age(0), absorbed(false) {
+        path.push_back(startPos);
+    }
+    
+    // Only called on active rays: RayStore keeps absorbed and escaped rays
+    // out of the span the kernels iterate
+    void update(const BlackHole& blackHole, float deltaTime, const FluxWriter* flux = nullptr) {
+        Vector2f toBlackHole = blackHole.getPosition() - currentPosition;
+        float schwarzschildRadius = blackHole.getSchwarzschildRadius();
+        
+        // Check if ray is absorbed by black hole
+        if (toBlackHole.lengthSquared() < schwarzschildRadius * schwarzschildRadius) {
+            absorbed = true;
+            return;
+        }
+        
+        // Gravitational acceleration using simplified general relativity
+        // F = G*M/r^2, but for light we use deflection angle approximation
+        float gravitationalConstant = blackHole.getMass() * GRAVITY_SCALE;
+        
+        // One square root gives the distance, 1/r and the radial direction
+        LengthAndDirection radial = lengthAndDirection<RAY_KERNEL_RSQRT>(toBlackHole);
+        
+        if constexpr (TRACK_SHAPIRO_DELAY) {
+            accumulateShapiro(2.0f * blackHole.getGravitationalRadius() * deltaTime, radial.inverseLength);
+        }
+        // A ray nobody emitted explicitly was emitted where it stands now,
+        // before its first move
+        if (needsEmission()) emitRedshift(blackHole.getGravitationalRadius(), radial.inverseLength);
+        
+        // Apply relativistic correction for light deflection
+        // Deflection angle ≈ 4GM/(c²b) where b is impact parameter
+        float deflectionFactor = 1.0f + (gravitationalConstant * 0.001f) / (radial.length * impactParameter + 1.0f);
+        float accelerationMagnitude = gravitationalConstant * radial.inverseLength * radial.inverseLength * deflectionFactor;
+        
+        // Update velocity and position using Verlet integration
+        currentVelocity += radial.direction * (accelerationMagnitude * deltaTime);
+        
+        // Maintain approximately constant speed for light
+        currentVelocity = lengthAndDirection<RAY_KERNEL_RSQRT>(currentVelocity).direction * LIGHT_SPEED;
+        
+        currentPosition += currentVelocity * deltaTime;
+        
+        if constexpr (TRACK_REDSHIFT) {
+            // Potential where the step ends, so z describes the current position
+            float inverseDistance = lengthAndDirection<RAY_KERNEL_RSQRT>(blackHole.getPosition() - currentPosition).inverseLength;
+            accumulateRedshift(blackHole.getGravitationalRadius(), inverseDistance);
+        }
+        
+        if (flux) flux->deposit(currentPosition);
+        
+        // Add point to path for visualization
+        age += deltaTime;
+        if (path.size() == 0 || distanceSquared(currentPosition, path.back()) > 4.0f) {
+            path.push_back(currentPosition, age);
+        }
+    }
+    
+    // Same step driven by the Kerr equatorial geodesic engine on the ray's
+    // photon state, which lives outside the ray. Constants of motion are
+    // taken from the current state while it is uninitialized.
+    void updateKerr(KerrPhoton& kerr, const BlackHole& blackHole, const KerrPhotonEngine& engine, float deltaTime,
+                    const FluxWriter* flux = nullptr) {
+        if (!kerr.initialized) {
+            engine.initialize(kerr, blackHole, currentPosition, currentVelocity);
+        }
+        if (needsEmission()) setEmitter(blackHole);
+        
+        engine.advance(kerr, blackHole, LIGHT_SPEED * deltaTime);
+        if (kerr.captured) {
+            absorbed = true;
+            return;
+        }
+        currentPosition = engine.position(kerr, blackHole);
+        currentVelocity = engine.velocity(kerr, blackHole);
+        
+        if constexpr (TRACK_SHAPIRO_DELAY || TRACK_REDSHIFT) {
+            float inverseDistance = static_cast<float>(1.0 / kerr.r);
+            accumulateShapiro(2.0f * blackHole.getGravitationalRadius() * deltaTime, inverseDistance);
+            accumulateRedshift(blackHole.getGravitationalRadius(), inverseDistance);
+        }
+        
+        if (flux) flux->deposit(currentPosition);
+        
+        age += deltaTime;
+        if (path.size() == 0 || distanceSquared(currentPosition, path.back()) > 4.0f) {
+            path.push_back(currentPosition, age);
+        }
+    }
+    
+    void draw(sf::RenderWindow& window) const {
+        if (path.size() < 2) return;
+        
+        // Draw the light ray path, decoding quantized storage first. A
+        // wrapped ring is two runs; the segment between them joins the halves.
+        thread_local std::vector<Vector2f> scratch;
+        PathSpans spans = path.decode(scratch);
+        const Vector2f* previous = nullptr;
+        for (Span<const Vector2f> points : {spans.first, spans.second}) {
+            for (const Vector2f& point : points) {
+                if (previous) {
+                    sf::Vertex line[] = {
+                        sf::Vertex(sf::Vector2f(previous->x, previous->y), color),
+                        sf::Vertex(sf::Vector2f(point.x, point.y), color)
+                    };
+                    window.draw(line, 2, sf::Lines);
+                }
+                previous = &point;
+            }
+        }
+        
+        // Draw current position as a small circle
+        if (!absorbed && currentPosition.x >= 0 && currentPosition.x <= WINDOW_WIDTH) {
+            sf::CircleShape photon(3);
+            photon.setFillColor(color);
+            photon.setOrigin(3, 3);
+            photon.setPosition(currentPosition.x, currentPosition.y);
+            window.draw(photon);
+        }
+    }
+    
+    bool isOffScreen() const {
+        return (currentPosition.x > WINDOW_WIDTH + 100 || 
+                currentPosition.x < -100 ||
+                currentPosition.y > WINDOW_HEIGHT + 100 || 
+                currentPosition.y < -100) && !absorbed;
+    }
+    
+    bool isAbsorbed() const { return absorbed; }
+    
+    // References so strided views can address the fields in place
+    const Vector2f& getPosition() const { return currentPosition; }
+    const Vector2f& getVelocity() const { return currentVelocity; }
+    sf::Color getColor() const { return color; }
+    float getImpactParameter() const { return impactParameter; }
+    const RayPath& getPath() const { return path; }
+    
+    // Records the emission point for the redshift at the ray's current
+    // position; called at spawn. Rays spawned without it are emitted where
+    // they start their first step.
+    void setEmitter(const BlackHole& blackHole) {
+        if constexpr (TRACK_REDSHIFT) {
+            float inverseDistance = lengthAndDirection(blackHole.getPosition() - currentPosition).inverseLength;
+            emitRedshift(blackHole.getGravitationalRadius(), inverseDistance);
+        }
+    }
+    
+    // A ray split from a wavefront segment shares its parents' emission
+    void inheritEmission(const LightRay& a, const LightRay& b) {
+        if (a.needsEmission() || b.needsEmission()) return;
+        inheritRedshift(0.5f * (a.emissionPotentialValue() + b.emissionPotentialValue()));
+    }
+    
+    // Extra arrival time in seconds; 0 unless built with BH_TRACK_SHAPIRO_DELAY
+    float getShapiroDelay() const { return shapiroDelaySeconds(); }
+    // Gravitational redshift z since emission; 0 unless built with BH_TRACK_REDSHIFT
+    float getRedshift() const { return redshiftZ(); }
+};
+
+// ---------------------------------------------------------------------------
+// Partitioned ray storage
+// ---------------------------------------------------------------------------
+
+// Ray slot map kept partitioned as [active | absorbed | escaped]. Rays change
+// partition by swaps when their status changes, so the integration kernels
+// run over one dense span of active rays and never test status per ray.
+// Escaped rays collect at the tail where they are dropped in bulk.
+//
+// Kerr photon states sit in a side array that follows every move of the
+// dense array, so the Schwarzschild kernel never streams them. They go stale
+// as soon as a Schwarzschild step moves the rays, and the next Kerr step
+// reinitializes them all at once.
+class RayStore {
+private:
+    SlotMap<LightRay, PolicyAllocator<LightRay>> rays;
+    std::vector<KerrPhoton> kerr;
+    std::vector<KerrPhoton> kerrScratch;  // reused by permuteActive
+    bool kerrStale = false;
+    std::size_t activeEnd = 0;
+    std::size_t absorbedEnd = 0;
+    
+    void swapAt(std::size_t a, std::size_t b) {
+        rays.swapAt(a, b);
+        std::swap(kerr[a], kerr[b]);
+    }
+    
+    void popBack() {
+        rays.eraseAt(rays.size() - 1);
+        kerr.pop_back();
+    }
+    
+public:
+    // New rays are appended to the escaped tail and rotated into the
+    // active partition with one swap per boundary
+    template <typename... Args>
+    RayHandle emplace(Args&&... args) {
+        RayHandle handle = rays.emplace(std::forward<Args>(args)...);
+        kerr.emplace_back();
+        swapAt(rays.size() - 1, absorbedEnd++);
+        swapAt(absorbedEnd - 1, activeEnd++);
+        return handle;
+    }
+    
+    // Walks the ray out to the tail across each boundary, then pops it
+    bool erase(RayHandle handle) {
+        if (!rays.contains(handle)) return false;
+        std::size_t index = rays.denseIndexOf(handle);
+        if (index < activeEnd) {
+            swapAt(index, --activeEnd);
+            index = activeEnd;
+        }
+        if (index < absorbedEnd) {
+            swapAt(index, --absorbedEnd);
+            index = absorbedEnd;
+        }
+        swapAt(index, rays.size() - 1);
+        popBack();
+        return true;
+    }
+    
+    // Moves rays that were absorbed or left the screen during the last step
+    // out of the active partition. Runs backwards so every ray swapped into
+    // position i has already been checked.
+    void partition() {
+        for (std::size_t i = activeEnd; i-- > 0;) {
+            const LightRay& ray = rays[i];
+            if (ray.isAbsorbed()) {
+                swapAt(i, --activeEnd);
+            } else if (ray.isOffScreen()) {
+                swapAt(i, --activeEnd);
+                swapAt(activeEnd, --absorbedEnd);
+            }
+        }
+    }
+    
+    // Removes every escaped ray; they are all at the tail so nothing moves
+    std::size_t dropEscaped() {
+        std::size_t dropped = rays.size() - absorbedEnd;
+        while (rays.size() > absorbedEnd) popBack();
+        return dropped;
+    }
+    
+    // Reorders the active partition only; order must cover activeCount()
+    void permuteActive(const std::vector<std::uint32_t>& order) {
+        rays.permute(order);
+        kerrScratch.resize(order.size());
+        for (std::size_t i = 0; i < order.size(); i++) kerrScratch[i] = kerr[order[i]];
+        std::copy(kerrScratch.begin(), kerrScratch.end(), kerr.begin());
+    }
+    
+    void clear() {
+        rays.clear();
+        kerr.clear();
+        activeEnd = 0;
+        absorbedEnd = 0;
+    }
+    
+    void reserve(std::size_t capacity) {
+        rays.reserve(capacity);
+        kerr.reserve(capacity);
+    }
+    
+    Span<LightRay> active() { return Span<LightRay>(rays.data(), activeEnd); }
+    Span<const LightRay> active() const { return Span<const LightRay>(rays.data(), activeEnd); }
+    
+    // Photon states of the active rays, reinitialized first if a
+    // Schwarzschild step has moved the rays since they were last used
+    Span<KerrPhoton> activeKerr() {
+        if (kerrStale) {
+            for (KerrPhoton& photon : kerr) photon.initialized = false;
+            kerrStale = false;
+        }
+        return Span<KerrPhoton>(kerr.data(), activeEnd);
+    }
+    void invalidateKerr() { kerrStale = true; }
+    std::size_t activeCount() const { return activeEnd; }
+    std::size_t absorbedCount() const { return absorbedEnd - activeEnd; }
+    std::size_t escapedCount() const { return rays.size() - absorbedEnd; }
+    
+    bool contains(RayHandle handle) const { return rays.contains(handle); }
+    LightRay* get(RayHandle handle) { return rays.get(handle); }
+    const LightRay* get(RayHandle handle) const { return rays.get(handle); }
+    RayHandle handleAt(std::size_t denseIndex) const { return rays.handleAt(denseIndex); }
+    std::size_t indexOf(RayHandle handle) const { return rays.denseIndexOf(handle); }
+    
+    std::size_t size() const { return rays.size(); }
+    LightRay& operator[](std::size_t denseIndex) { return rays[denseIndex]; }
+    const LightRay& operator[](std::size_t denseIndex) const { return rays[denseIndex]; }
+    
+    auto begin() { return rays.begin(); }
+    auto end() { return rays.end(); }
+    auto begin() const { return rays.begin(); }
+    auto end() const { return rays.end(); }
+};
+
+struct StepResult {
+    std::size_t stepped;
+    std::size_t escaped;
+};
+
+// One integration step over the active rays, each worker depositing into its
+// own flux grid when one is given, then the status partition pass. Shared by
+// the SFML front end and the C API. Pass a Kerr engine to integrate geodesics.
+StepResult stepRays(WorkerPool& pool, RayStore& rays, const BlackHole& hole, const KerrPhotonEngine* kerrEngine,
+              float deltaTime, FluxAccumulator* flux = nullptr) {
+    Span<LightRay> active = rays.active();
+    Span<KerrPhoton> kerr;
+    if (kerrEngine) kerr = rays.activeKerr();
+    else rays.invalidateKerr();
+    pool.parallelFor(active.size, [&](std::size_t begin, std::size_t end, unsigned worker) {
+        FluxWriter fluxWriter{};
+        if (flux) fluxWriter = flux->writer(worker);
+        const FluxWriter* writer = flux ? &fluxWriter : nullptr;
+        if (kerrEngine) {
+            for (std::size_t i = begin; i < end; i++) {
+                active[i].updateKerr(kerr[i], hole, *kerrEngine, deltaTime, writer);
+            }
+        } else {
+            for (std::size_t i = begin; i < end; i++) {
+                active[i].update(hole, deltaTime, writer);
+            }
+        }
+    });
+    if (flux) flux->advance(deltaTime);
+    
+    // Move absorbed and off-screen rays out of the active span, then drop
+    // the off-screen ones
+    rays.partition();
+    return {active.size, rays.dropEscaped()};
+}
+
+// Writes one CSV row per live ray. Accumulator columns appear only when the
+// corresponding feature is compiled in.
+void writeRayStates(const RayStore& rays, std::ostream& out) {
+    out << "handle,generation,x,y,vx,vy,absorbed,path_points";
+    if (TRACK_SHAPIRO_DELAY) out << ",shapiro_delay_s";
+    if (TRACK_REDSHIFT) out << ",redshift_z";
+    out << "\n";
+    for (std::size_t i = 0; i < rays.size(); i++) {
+        const LightRay& ray = rays[i];
+        RayHandle handle = rays.handleAt(i);
+        out << handle.index << "," << handle.generation << ","
+            << ray.getPosition().x << "," << ray.getPosition().y << ","
+            << ray.getVelocity().x << "," << ray.getVelocity().y << ","
+            << ray.isAbsorbed() << "," << ray.getPath().size();
+        if (TRACK_SHAPIRO_DELAY) out << "," << ray.getShapiroDelay();
+        if (TRACK_REDSHIFT) out << "," << ray.getRedshift();
+        out << "\n";
+    }
+}
+
+bool exportRayStates(const RayStore& rays, const std::string& filename) {
+    std::ofstream out(filename);
+    if (!out) return false;
+    writeRayStates(rays, out);
+    return static_cast<bool>(out);
+}
+
+// ---------------------------------------------------------------------------
+// HDR trail accumulation
+// ---------------------------------------------------------------------------
+
+// Additive linear-radiance image of every trail. Overlapping trails sum
+// instead of overwriting each other, so brightness shows where light
+// concentrates.
+//
+// accumulate() runs two parallel passes. The first walks each path (both
+// ring spans; quantized paths are decoded once) and bins runs of consecutive
+// segments by the screen tile they touch, into per-worker bins. The second
+// hands out whole tiles: a worker clears its tile and splats every segment
+// binned there, writing only that tile's pixels, so no two workers share
+// memory and no atomics are needed. toneMap() is a separate flat pass.
+class TrailAccumulator {
+public:
+    static constexpr int TILE_SIZE = 64;
+    
+private:
+    // Segments [first, first + count) of one trail, all touching one tile
+    struct TrailRun {
+        std::uint32_t trail;
+        std::uint32_t first;
+        std::uint32_t count;
+    };
+    
+    struct Trail {
+        PathSpans spans;
+        float color[3];     // radiance deposited per pixel of length
+    };
+    
+    int width;
+    int height;
+    int tilesX;
+    int tilesY;
+    float exposure;
+    std::vector<float> radiance;    // linear RGBA per pixel; the A lane keeps rows 16-byte aligned
+    std::vector<Trail> trails;
+    std::vector<std::vector<Vector2f>> decoded;     // quantized paths, one per trail
+    std::vector<std::vector<TrailRun>> bins;        // [worker * tileCount() + tile]
+    std::vector<std::size_t> workerSegments;
+    std::size_t lastSegments = 0;
+    double lastAccumulateMilliseconds = 0;
+    double lastToneMapMilliseconds = 0;
+    
+    std::size_t tileCount() const { return static_cast<std::size_t>(tilesX) * tilesY; }
+    
+    static Vector2f pointAt(const PathSpans& spans, std::size_t k) {
+        return k < spans.first.size ? spans.first[k] : spans.second[k - spans.first.size];
+    }
+    
+    void binTrail(std::uint32_t t, unsigned worker) {
+        const PathSpans& spans = trails[t].spans;
+        if (spans.size() < 2) return;
+        std::vector<TrailRun>* workerBins = &bins[worker * tileCount()];
+        int openTile = -1;
+        TrailRun run{};
+        auto closeRun = [&]() {
+            if (openTile >= 0) workerBins[openTile].push_back(run);
+            openTile = -1;
+        };
+        
+        Vector2f a = pointAt(spans, 0);
+        for (std::size_t k = 0; k + 1 < spans.size(); k++) {
+            Vector2f b = pointAt(spans, k + 1);
+            // Pixels the bilinear splat can reach lie within a pixel of the segment
+            float minX = std::min(a.x, b.x) - 1.0f, maxX = std::max(a.x, b.x) + 1.0f;
+            float minY = std::min(a.y, b.y) - 1.0f, maxY = std::max(a.y, b.y) + 1.0f;
+            a = b;
+            if (maxX < 0.0f || maxY < 0.0f || minX >= width || minY >= height) {
+                closeRun();
+                continue;
+            }
+            int tx0 = static_cast<int>(std::max(minX, 0.0f)) / TILE_SIZE;
+            int tx1 = static_cast<int>(std::min(maxX, width - 1.0f)) / TILE_SIZE;
+            int ty0 = static_cast<int>(std::max(minY, 0.0f)) / TILE_SIZE;
+            int ty1 = static_cast<int>(std::min(maxY, height - 1.0f)) / TILE_SIZE;
+            std::uint32_t segment = static_cast<std::uint32_t>(k);
+            if (tx0 == tx1 && ty0 == ty1) {
+                int tile = ty0 * tilesX + tx0;
+                if (tile == openTile) {
+                    run.count++;
+                } else {
+                    closeRun();
+                    openTile = tile;
+                    run = {t, segment, 1};
+                }
+                continue;
+            }
+            // Straddles a tile edge: every tile it touches gets its own entry
+            closeRun();
+            for (int ty = ty0; ty <= ty1; ty++) {
+                for (int tx = tx0; tx <= tx1; tx++) {
+                    workerBins[ty * tilesX + tx].push_back({t, segment, 1});
+                }
+            }
+        }
+        closeRun();
+        workerSegments[worker] += spans.size() - 1;
+    }
+    
+    // Box-filtered line: bilinear splats about a pixel apart, each weighted
+    // by the length it stands for, clipped to [x0, x1) x [y0, y1)
+    void splatSegment(Vector2f a, Vector2f b, const float color[3], int x0, int y0, int x1, int y1) {
+        Vector2f d = b - a;
+        float length = std::sqrt(d.x * d.x + d.y * d.y);
+        if (length <= 0.0f) return;
+        int samples = static_cast<int>(std::ceil(length));
+        float weight = length / samples;
+        float spacing = 1.0f / samples;
+        for (int i = 0; i < samples; i++) {
+            float t = (i + 0.5f) * spacing;
+            float fx = a.x + d.x * t - 0.5f;
+            float fy = a.y + d.y * t - 0.5f;
+            // Truncate and step down for negatives: floor without a libm call
+            int ix = static_cast<int>(fx), iy = static_cast<int>(fy);
+            ix -= fx < static_cast<float>(ix);
+            iy -= fy < static_cast<float>(iy);
+            float wx = fx - ix, wy = fy - iy;
+            const float weights[4] = {(1.0f - wx) * (1.0f - wy) * weight, wx * (1.0f - wy) * weight,
+                                      (1.0f - wx) * wy * weight, wx * wy * weight};
+            if (ix >= x0 && ix + 1 < x1 && iy >= y0 && iy + 1 < y1) {
+                // Whole 2x2 footprint inside the tile, the common case
+                float* pixel = &radiance[(static_cast<std::size_t>(iy) * width + ix) * 4];
+                for (int c = 0; c < 3; c++) {
+                    pixel[c] += color[c] * weights[0];
+                    pixel[4 + c] += color[c] * weights[1];
+                    pixel[width * 4 + c] += color[c] * weights[2];
+                    pixel[width * 4 + 4 + c] += color[c] * weights[3];
+                }
+                continue;
+            }
+            for (int corner = 0; corner < 4; corner++) {
+                int x = ix + (corner & 1), y = iy + (corner >> 1);
+                if (x < x0 || x >= x1 || y < y0 || y >= y1) continue;
+                float* target = &radiance[(static_cast<std::size_t>(y) * width + x) * 4];
+                for (int c = 0; c < 3; c++) target[c] += color[c] * weights[corner];
+            }
+        }
+    }
+    
+    void rasterizeTile(std::size_t tile, unsigned workers) {
+        int x0 = static_cast<int>(tile % tilesX) * TILE_SIZE, y0 = static_cast<int>(tile / tilesX) * TILE_SIZE;
+        int x1 = std::min(width, x0 + TILE_SIZE), y1 = std::min(height, y0 + TILE_SIZE);
+        for (int y = y0; y < y1; y++) {
+            std::fill_n(&radiance[(static_cast<std::size_t>(y) * width + x0) * 4], (x1 - x0) * 4, 0.0f);
+        }
+        for (unsigned w = 0; w < workers; w++) {
+            for (const TrailRun& run : bins[w * tileCount() + tile]) {
+                const Trail& trail = trails[run.trail];
+                Vector2f a = pointAt(trail.spans, run.first);
+                for (std::uint32_t k = run.first; k < run.first + run.count; k++) {
+                    Vector2f b = pointAt(trail.spans, k + 1);
+                    splatSegment(a, b, trail.color, x0, y0, x1, y1);
+                    a = b;
+                }
+            }
+        }
+    }
+    
+public:
+    TrailAccumulator(int width, int height, float exposure = 0.5f)
+        : width(width), height(height),
+          tilesX((width + TILE_SIZE - 1) / TILE_SIZE), tilesY((height + TILE_SIZE - 1) / TILE_SIZE),
+          exposure(exposure), radiance(static_cast<std::size_t>(width) * height * 4) {}
+    
+    // Rebuilds the image from count trails; pathOf(i) returns a RayPath and
+    // colorOf(i) an sf::Color scaled by intensity per pixel of trail
+    template <typename PathOf, typename ColorOf>
+    void accumulate(WorkerPool& pool, std::size_t count, PathOf pathOf, ColorOf colorOf, float intensity = 1.0f) {
+        auto start = std::chrono::steady_clock::now();
+        unsigned workers = static_cast<unsigned>(pool.size());
+        bins.resize(workers * tileCount());
+        for (auto& bin : bins) bin.clear();
+        workerSegments.assign(workers, 0);
+        trails.resize(count);
+        if (decoded.size() < count) decoded.resize(count);
+        
+        pool.parallelForDynamic(count, 64, [&](std::size_t begin, std::size_t end, unsigned worker) {
+            for (std::size_t i = begin; i < end; i++) {
+                Trail& trail = trails[i];
+                trail.spans = pathOf(i).decode(decoded[i]);
+                sf::Color color = colorOf(i);
+                trail.color[0] = color.r * (intensity / 255.0f);
+                trail.color[1] = color.g * (intensity / 255.0f);
+                trail.color[2] = color.b * (intensity / 255.0f);
+                binTrail(static_cast<std::uint32_t>(i), worker);
+            }
+        });
+        pool.parallelForDynamic(tileCount(), 1, [&](std::size_t begin, std::size_t end, unsigned) {
+            for (std::size_t tile = begin; tile < end; tile++) rasterizeTile(tile, workers);
+        });
+        
+        lastSegments = 0;
+        for (std::size_t segments : workerSegments) lastSegments += segments;
+        lastAccumulateMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    
+    void accumulate(WorkerPool& pool, const RayStore& rays, float intensity = 1.0f) {
+        accumulate(pool, rays.size(), [&](std::size_t i) -> const RayPath& { return rays[i].getPath(); },
+                   [&](std::size_t i) { return rays[i].getColor(); }, intensity);
+    }
+    
+    // Exposure, Reinhard v / (1 + v), then t (2 - t) as a cheap display
+    // gamma. Blocks of a fixed length keep the loop free of sqrt and pow so
+    // it vectorizes.
+    void toneMap(WorkerPool& pool, std::vector<sf::Uint8>& rgba) {
+        auto start = std::chrono::steady_clock::now();
+        constexpr std::size_t BLOCK = 64;
+        rgba.resize(radiance.size());
+        std::size_t blocks = radiance.size() / BLOCK;
+        float scale = exposure;
+        auto map = [scale](const float* __restrict in, sf::Uint8* __restrict out, std::size_t count) {
+            for (std::size_t i = 0; i < count; i++) {
+                float v = in[i] * scale;
+                float t = v / (1.0f + v);
+                out[i] = static_cast<sf::Uint8>(255.0f * t * (2.0f - t) + 0.5f);
+            }
+        };
+        pool.parallelFor(blocks, [&](std::size_t begin, std::size_t end, unsigned) {
+            for (std::size_t b = begin; b < end; b++) map(&radiance[b * BLOCK], &rgba[b * BLOCK], BLOCK);
+        });
+        map(radiance.data() + blocks * BLOCK, rgba.data() + blocks * BLOCK, radiance.size() - blocks * BLOCK);
+        for (std::size_t i = 3; i < rgba.size(); i += 4) rgba[i] = 255;
+        lastToneMapMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    
+    void setExposure(float value) { exposure = value; }
+    float getExposure() const { return exposure; }
+    // Linear RGBA radiance, row-major
+    const std::vector<float>& getRadiance() const { return radiance; }
+    std::size_t getLastSegments() const { return lastSegments; }
+    double getLastAccumulateMilliseconds() const { return lastAccumulateMilliseconds; }
+    double getLastToneMapMilliseconds() const { return lastToneMapMilliseconds; }
+};
+
+// ---------------------------------------------------------------------------
+// Batched parameter sweeps
+// ---------------------------------------------------------------------------
+
+struct SweepRay {
+    Vector2f position;
+    Vector2f velocity;
+    float impactParameter;
+    bool absorbed = false;
+};
+
+// One small independent configuration in a sweep
+struct SweepScene {
+    Vector2f holePosition;
+    float mass;
+    std::vector<SweepRay> rays;
+};
+
+// Steps many small scenes together. Rays from every scene are packed into
+// structure-of-arrays blocks of LANES, each lane carrying its own scene's
+// hole parameters, so one vector instruction advances rays from different
+// scenes at once. The physics is LightRay::update without trajectories or
+// flux; absorption is a lane mask rather than a branch, and square roots use
+// the refined fast rsqrt so the whole block vectorizes.
+class SweepBatch {
+public:
+    static constexpr std::size_t LANES = 16;
+    
+private:
+    struct alignas(64) Block {
+        float px[LANES], py[LANES], vx[LANES], vy[LANES];
+        float holeX[LANES], holeY[LANES], gravity[LANES], horizonSq[LANES], impact[LANES];
+        float live[LANES];      // 0 once absorbed, and for padding lanes
+    };
+    
+    std::vector<Block> blocks;
+    std::size_t rayCount = 0;
+    
+    static void stepBlock(Block& b, float dt) {
+        for (std::size_t l = 0; l < LANES; l++) {
+            float dx = b.holeX[l] - b.px[l];
+            float dy = b.holeY[l] - b.py[l];
+            float distanceSq = dx * dx + dy * dy;
+            // The horizon test comes before the move, as in LightRay::update
+            float live = distanceSq < b.horizonSq[l] ? 0.0f : b.live[l];
+            
+            // The epsilon keeps a lane sitting on the hole finite under the mask
+            // (std::max would be a branch GCC will not vectorize at -O2)
+            float inverseLength = rsqrt<RsqrtMode::FastRefined>(distanceSq + 1e-6f);
+            float length = distanceSq * inverseLength;
+            float deflection = 1.0f + (b.gravity[l] * 0.001f) / (length * b.impact[l] + 1.0f);
+            float impulse = b.gravity[l] * inverseLength * inverseLength * deflection * dt * inverseLength;
+            float vx = b.vx[l] + dx * impulse;
+            float vy = b.vy[l] + dy * impulse;
+            float speedScale = LIGHT_SPEED * rsqrt<RsqrtMode::FastRefined>(vx * vx + vy * vy);
+            vx *= speedScale;
+            vy *= speedScale;
+            
+            // Blend by the mask instead of branching; dead lanes keep their state
+            b.vx[l] += live * (vx - b.vx[l]);
+            b.vy[l] += live * (vy - b.vy[l]);
+            b.px[l] += live * vx * dt;
+            b.py[l] += live * vy * dt;
+            b.live[l] = live;
+        }
+    }
+    
+public:
+    // Flattens every scene's rays, in order, into lane blocks
+    void pack(const std::vector<SweepScene>& scenes) {
+        rayCount = 0;
+        for (const SweepScene& scene : scenes) rayCount += scene.rays.size();
+        blocks.assign((rayCount + LANES - 1) / LANES, Block{});
+        std::size_t lane = 0;
+        for (const SweepScene& scene : scenes) {
+            float gravity = scene.mass * GRAVITY_SCALE;
+            float horizon = scene.mass * 0.01f;     // BlackHole's Schwarzschild radius
+            for (const SweepRay& ray : scene.rays) {
+                Block& b = blocks[lane / LANES];
+                std::size_t l = lane % LANES;
+                b.px[l] = ray.position.x;
+                b.py[l] = ray.position.y;
+                b.vx[l] = ray.velocity.x;
+                b.vy[l] = ray.velocity.y;
+                b.holeX[l] = scene.holePosition.x;
+                b.holeY[l] = scene.holePosition.y;
+                b.gravity[l] = gravity;
+                b.horizonSq[l] = horizon * horizon;
+                b.impact[l] = ray.impactParameter;
+                b.live[l] = ray.absorbed ? 0.0f : 1.0f;
+                lane++;
+            }
+        }
+        // Padding lanes sit idle with a unit velocity so they stay finite
+        for (; lane < blocks.size() * LANES; lane++) {
+            blocks[lane / LANES].vx[lane % LANES] = 1.0f;
+            blocks[lane / LANES].px[lane % LANES] = 1.0f;
+        }
+    }
+    
+    // Blocks are independent, so each runs every step while it is in cache
+    void step(WorkerPool& pool, float dt, int steps) {
+        pool.parallelFor(blocks.size(), [&](std::size_t begin, std::size_t end, unsigned) {
+            for (std::size_t i = begin; i < end; i++) {
+                for (int s = 0; s < steps; s++) stepBlock(blocks[i], dt);
+            }
+        });
+    }
+    
+    // Writes the lane states back to the scenes they were packed from
+    void scatter(std::vector<SweepScene>& scenes) const {
+        std::size_t lane = 0;
+        for (SweepScene& scene : scenes) {
+            for (SweepRay& ray : scene.rays) {
+                const Block& b = blocks[lane / LANES];
+                std::size_t l = lane % LANES;
+                ray.position = Vector2f(b.px[l], b.py[l]);
+                ray.velocity = Vector2f(b.vx[l], b.vy[l]);
+                ray.absorbed = b.live[l] == 0.0f;
+                lane++;
+            }
+        }
+    }
+    
+    std::size_t size() const { return rayCount; }
+};
+
+// ---------------------------------------------------------------------------
+// Morton-order ray sorting
+// ---------------------------------------------------------------------------
+
+// Interleaves the low 16 bits of x and y into a Z-order curve key
+constexpr std::uint32_t mortonKey(std::uint32_t x, std::uint32_t y) {
+    auto spread = [](std::uint32_t v) {
+        v &= 0xffffu;
+        v = (v | (v << 8)) & 0x00ff00ffu;
+        v = (v | (v << 4)) & 0x0f0f0f0fu;
+        v = (v | (v << 2)) & 0x33333333u;
+        v = (v | (v << 1)) & 0x55555555u;
+        return v;
+    };
+    return spread(x) | (spread(y) << 1);
+}
+
+// Periodically re-sorts the ray store along a Z-order curve so rays that are
+// close on screen are close in memory when they sample the flux grid or
+// other fields. Every cadence frames it measures disorder (the fraction of
+// neighbours whose keys are out of order) and only sorts when the estimated
+// saving until the next check beats the estimated sort cost. Nearly sorted
+// arrays are fixed with an insertion pass, so steady-state re-sorts are close
+// to linear; few descents do not bound how far rays moved, so the pass gives
+// up for std::sort after a fixed number of shifts per ray. Handles are
+// unaffected since the slot map is only permuted.
+class MortonSorter {
+private:
+    static constexpr std::size_t MAX_SHIFTS_PER_RAY = 8;
+    
+    int cadence;
+    float cellSize;
+    float missCostNs;       // cost of one out-of-order ray per frame
+    float moveCostNs;       // per-ray sort cost, calibrated from real sorts
+    int framesSinceCheck = 0;
+    std::size_t sortCount = 0;
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> keyed;
+    std::vector<std::uint32_t> order;
+    
+public:
+    explicit MortonSorter(int cadence = 30, float cellSize = 8.0f, float missCostNs = 20.0f)
+        : cadence(cadence), cellSize(cellSize), missCostNs(missCostNs), moveCostNs(10.0f) {}
+    
+    void setCadence(int frames) { cadence = std::max(1, frames); }
+    
+    // Computes a key per active ray and returns how many neighbours are out
+    // of order; absorbed and escaped rays are never sorted
+    std::size_t computeKeys(const RayStore& rays) {
+        std::size_t n = rays.activeCount();
+        keyed.resize(n);
+        std::size_t descents = 0;
+        for (std::size_t i = 0; i < n; i++) {
+            Vector2f p = rays[i].getPosition();
+            // Offset keeps the margin around the window non-negative
+            auto cx = static_cast<std::uint32_t>(std::clamp((p.x + 1024.0f) / cellSize, 0.0f, 65535.0f));
+            auto cy = static_cast<std::uint32_t>(std::clamp((p.y + 1024.0f) / cellSize, 0.0f, 65535.0f));
+            keyed[i] = {mortonKey(cx, cy), static_cast<std::uint32_t>(i)};
+            if (i > 0 && keyed[i - 1].first > keyed[i].first) descents++;
+        }
+        return descents;
+    }
+    
+    // Returns true if the store was re-sorted this frame
+    bool update(RayStore& rays) {
+        if (++framesSinceCheck < cadence || rays.activeCount() < 2) return false;
+        framesSinceCheck = 0;
+        
+        std::size_t n = rays.activeCount();
+        double disorder = static_cast<double>(computeKeys(rays)) / n;
+        bool nearlySorted = disorder < 0.05;
+        double benefit = disorder * n * missCostNs * cadence;
+        double cost = n * moveCostNs * (nearlySorted ? 1.0 : std::log2(static_cast<double>(n)));
+        if (benefit <= cost) return false;
+        
+        sort(rays, nearlySorted);
+        return true;
+    }
+    
+    // Sorts using the keys from the last computeKeys(); insertion sort when
+    // the array is already nearly in order, bounded to MAX_SHIFTS_PER_RAY
+    // shifts per ray on average before falling back to std::sort
+    void sort(RayStore& rays, bool nearlySorted) {
+        std::size_t n = keyed.size();
+        auto start = std::chrono::steady_clock::now();
+        bool insertion = nearlySorted;
+        if (insertion) {
+            std::size_t shifts = 0;
+            for (std::size_t i = 1; i < n && insertion; i++) {
+                auto item = keyed[i];
+                std::size_t j = i;
+                while (j > 0 && keyed[j - 1].first > item.first) {
+                    keyed[j] = keyed[j - 1];
+                    j--;
+                }
+                keyed[j] = item;
+                // Some rays moved far, so the rest of the pass could be quadratic
+                shifts += i - j;
+                if (shifts > MAX_SHIFTS_PER_RAY * n) insertion = false;
+            }
+        }
+        if (!insertion) std::sort(keyed.begin(), keyed.end());
+        order.resize(n);
+        for (std::size_t i = 0; i < n; i++) order[i] = keyed[i].second;
+        rays.permuteActive(order);
+        
+        // Calibrate the per-ray cost towards what this sort actually took
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        double perRay = ns / (n * (insertion ? 1.0 : std::log2(static_cast<double>(n))));
+        moveCostNs = static_cast<float>(0.8 * moveCostNs + 0.2 * perRay);
+        sortCount++;
+    }
+    
+    std::size_t getSortCount() const { return sortCount; }
+};
+
+// ---------------------------------------------------------------------------
+// Caustic detection
+// ---------------------------------------------------------------------------
+
+// Collects fold and cusp crossings reported by the wavefront engine and links
+// them into caustic polylines as they happen. A fold is where a front segment
+// turns inside out (its triangle with the propagation direction flips
+// orientation); two adjacent segments flipping in the same step mark a cusp.
+// Cusps on the lens axis are the 2D counterpart of an Einstein ring. Linking
+// uses a spatial hash of open curve ends, so each step costs O(events).
+class CausticTracker {
+public:
+    enum class EventKind { Fold, Cusp, EinsteinRing };
+    
+    struct Event {
+        Vector2f position;
+        EventKind kind;
+        std::uint64_t step;
+    };
+    
+    struct Curve {
+        std::vector<Vector2f> points;
+        std::uint64_t lastStep;
+        bool open;
+    };
+    
+private:
+    std::vector<Curve> curves;
+    std::vector<Event> cusps;
+    std::vector<std::size_t> openCurves;
+    std::uint64_t step = 0;
+    float linkDistance;
+    std::uint64_t maxGapSteps;
+    Vector2f lensPosition;
+    Vector2f lensAxis = Vector2f(1, 0);
+    float axisTolerance = 6.0f;
+    std::size_t foldCount = 0;
+    
+    std::unordered_map<std::uint64_t, std::vector<std::size_t>> endpointCells;
+    
+    std::uint64_t cellKey(const Vector2f& p) const {
+        auto cx = static_cast<std::int64_t>(std::floor(p.x / linkDistance));
+        auto cy = static_cast<std::int64_t>(std::floor(p.y / linkDistance));
+        return (static_cast<std::uint64_t>(cx) << 32) ^ static_cast<std::uint32_t>(cy);
+    }
+    
+public:
+    explicit CausticTracker(float linkDistance = 15.0f, std::uint64_t maxGapSteps = 8)
+        : linkDistance(linkDistance), maxGapSteps(maxGapSteps) {}
+    
+    // Lens position and the fronts' propagation direction define the axis
+    void setLens(const Vector2f& position, const Vector2f& axis) {
+        lensPosition = position;
+        lensAxis = axis.normalized();
+    }
+    
+    void beginStep() {
+        step++;
+        endpointCells.clear();
+        std::vector<std::size_t> stillOpen;
+        for (std::size_t index : openCurves) {
+            Curve& curve = curves[index];
+            if (step - curve.lastStep > maxGapSteps) {
+                curve.open = false;
+                continue;
+            }
+            stillOpen.push_back(index);
+            endpointCells[cellKey(curve.points.back())].push_back(index);
+        }
+        openCurves = std::move(stillOpen);
+    }
+    
+    void recordFold(const Vector2f& position) {
+        foldCount++;
+        float linkSq = linkDistance * linkDistance;
+        std::uint64_t center = cellKey(position);
+        std::size_t best = curves.size();
+        float bestSq = linkSq;
+        auto cx = static_cast<std::int64_t>(std::floor(position.x / linkDistance));
+        auto cy = static_cast<std::int64_t>(std::floor(position.y / linkDistance));
+        for (int dy = -1; dy <= 1; dy++) {
+            for (int dx = -1; dx <= 1; dx++) {
+                std::uint64_t key = (static_cast<std::uint64_t>(cx + dx) << 32) ^ static_cast<std::uint32_t>(cy + dy);
+                auto it = endpointCells.find(key);
+                if (it == endpointCells.end()) continue;
+                for (std::size_t index : it->second) {
+                    float dSq = distanceSquared(curves[index].points.back(), position);
+                    if (dSq < bestSq && curves[index].lastStep != step) {
+                        bestSq = dSq;
+                        best = index;
+                    }
+                }
+            }
+        }
+        
+        if (best < curves.size()) {
+            curves[best].points.push_back(position);
+            curves[best].lastStep = step;
+        } else {
+            curves.push_back({{position}, step, true});
+            openCurves.push_back(curves.size() - 1);
+            endpointCells[center].push_back(curves.size() - 1);
+        }
+    }
+    
+    void recordCusp(const Vector2f& position) {
+        Vector2f offset = position - lensPosition;
+        bool onAxis = offset.dot(lensAxis) > 0 && std::abs(offset.cross(lensAxis)) < axisTolerance;
+        cusps.push_back({position, onAxis ? EventKind::EinsteinRing : EventKind::Cusp, step});
+    }
+    
+    void clear() {
+        curves.clear();
+        cusps.clear();
+        openCurves.clear();
+        endpointCells.clear();
+        foldCount = 0;
+    }
+    
+    const std::vector<Curve>& getCurves() const { return curves; }
+    const std::vector<Event>& getCusps() const { return cusps; }
+    std::size_t getFoldCount() const { return foldCount; }
+    
+    void draw(sf::RenderWindow& window) const {
+        sf::Color curveColor(255, 160, 40);
+        for (const Curve& curve : curves) {
+            if (curve.points.size() < 2) continue;
+            sf::VertexArray strip(sf::LineStrip, curve.points.size());
+            for (std::size_t i = 0; i < curve.points.size(); i++) {
+                strip[i] = sf::Vertex(sf::Vector2f(curve.points[i].x, curve.points[i].y), curveColor);
+            }
+            window.draw(strip);
+        }
+        for (const Event& cusp : cusps) {
+            sf::CircleShape marker(4);
+            marker.setOrigin(4, 4);
+            marker.setPosition(cusp.position.x, cusp.position.y);
+            marker.setFillColor(cusp.kind == EventKind::EinsteinRing ? sf::Color::White : sf::Color(255, 80, 80));
+            window.draw(marker);
+        }
+    }
+    
+    // One row per polyline vertex, then one row per cusp
+    bool exportCSV(const std::string& filename) const {
+        std::ofstream out(filename);
+        if (!out) return false;
+        writeCSV(out);
+        return static_cast<bool>(out);
+    }
+    
+    void writeCSV(std::ostream& out) const {
+        out << "kind,curve,x,y,step\n";
+        for (std::size_t c = 0; c < curves.size(); c++) {
+            for (const Vector2f& p : curves[c].points) {
+                out << "fold," << c << "," << p.x << "," << p.y << "," << curves[c].lastStep << "\n";
+            }
+        }
+        for (const Event& cusp : cusps) {
+            out << (cusp.kind == EventKind::EinsteinRing ? "einstein_ring" : "cusp") << ",-1,"
+                << cusp.position.x << "," << cusp.position.y << "," << cusp.step << "\n";
+        }
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Adaptive wavefronts
+// ---------------------------------------------------------------------------
+
+// Tracks emitted rays as connected fronts (ordered chains of ray handles).
+// After every step neighbours that drifted further apart than splitDistance
+// get a new ray interpolated between them, and interior rays closer than
+// mergeDistance to their predecessor are retired. Absorbed or removed rays
+// cut a front into independent pieces. Each node also remembers the
+// orientation of the segment to its successor, so fold crossings are found
+// in the same pass.
+class WavefrontEngine {
+private:
+    struct FrontNode {
+        RayHandle ray;
+        signed char orientation;  // sign of the segment triangle, 0 if unknown
+    };
+    
+    std::vector<std::vector<FrontNode>> fronts;
+    float splitDistance;
+    float mergeDistance;
+    std::size_t maxRays;  // splitting stops while this many rays are in flight
+    std::size_t raysInserted = 0;
+    std::size_t raysMerged = 0;
+    
+    static LightRay interpolate(const LightRay& a, const LightRay& b) {
+        Vector2f position = (a.getPosition() + b.getPosition()) * 0.5f;
+        Vector2f velocity = (a.getVelocity() + b.getVelocity()).normalized() * LIGHT_SPEED;
+        float impact = 0.5f * (a.getImpactParameter() + b.getImpactParameter());
+        LightRay ray(position, velocity, a.getColor(), impact);
+        ray.inheritEmission(a, b);
+        return ray;
+    }
+    
+    // Orientation of the triangle (a, b, a + propagation direction)
+    static signed char segmentOrientation(const LightRay& a, const LightRay& b) {
+        float side = (b.getPosition() - a.getPosition()).cross(a.getVelocity() + b.getVelocity());
+        return side > 0 ? 1 : (side < 0 ? -1 : 0);
+    }
+    
+    void detectFolds(const RayStore& rays, std::vector<FrontNode>& piece, CausticTracker* caustics) {
+        bool previousFlipped = false;
+        for (std::size_t j = 0; j + 1 < piece.size(); j++) {
+            const LightRay& a = *rays.get(piece[j].ray);
+            const LightRay& b = *rays.get(piece[j + 1].ray);
+            signed char orientation = segmentOrientation(a, b);
+            bool flipped = piece[j].orientation != 0 && orientation != 0 && orientation != piece[j].orientation;
+            if (flipped && caustics) {
+                Vector2f midpoint = (a.getPosition() + b.getPosition()) * 0.5f;
+                caustics->recordFold(midpoint);
+                if (previousFlipped) caustics->recordCusp(a.getPosition());
+            }
+            previousFlipped = flipped;
+            piece[j].orientation = orientation;
+        }
+    }
+    
+public:
+    explicit WavefrontEngine(float splitDistance = 30.0f, float mergeDistance = 5.0f, std::size_t maxRays = 20000)
+        : splitDistance(splitDistance), mergeDistance(mergeDistance), maxRays(maxRays) {}
+    
+    // Emits count rays evenly spaced on the segment from start to end
+    void emit(RayStore& rays, Vector2f start, Vector2f end, Vector2f velocity, int count, sf::Color color) {
+        std::vector<FrontNode> front;
+        for (int i = 0; i < count; i++) {
+            float t = count > 1 ? static_cast<float>(i) / (count - 1) : 0.5f;
+            front.push_back({rays.emplace(start + (end - start) * t, velocity, color), 0});
+        }
+        fronts.push_back(std::move(front));
+    }
+    
+    // Rebuilds every front in one pass, splitting and merging as needed and
+    // reporting fold crossings to the caustic tracker
+    void refine(RayStore& rays, CausticTracker* caustics = nullptr) {
+        std::vector<std::vector<FrontNode>> refined;
+        float splitSq = splitDistance * splitDistance;
+        float mergeSq = mergeDistance * mergeDistance;
+        if (caustics) caustics->beginStep();
+        
+        auto finishPiece = [&](std::vector<FrontNode>& piece) {
+            if (piece.size() >= 2) {
+                detectFolds(rays, piece, caustics);
+                refined.push_back(std::move(piece));
+            }
+            piece.clear();
+        };
+        
+        for (auto& front : fronts) {
+            std::vector<FrontNode> piece;
+            for (std::size_t i = 0; i < front.size(); i++) {
+                const LightRay* ray = rays.get(front[i].ray);
+                if (!ray || ray->isAbsorbed()) {
+                    finishPiece(piece);
+                    continue;
+                }
+                if (!piece.empty()) {
+                    const LightRay& previous = *rays.get(piece.back().ray);
+                    float gapSq = distanceSquared(previous.getPosition(), ray->getPosition());
+                    bool isLast = i + 1 == front.size();
+                    // Absorbed rays stay in the store for their trails but
+                    // no longer cost a step, so only active ones count
+                    if (gapSq > splitSq && rays.activeCount() < maxRays) {
+                        // emplace may reallocate, so copy the new ray first;
+                        // both halves inherit the split segment's orientation
+                        LightRay middle = interpolate(previous, *ray);
+                        piece.push_back({rays.emplace(std::move(middle)), piece.back().orientation});
+                        raysInserted++;
+                    } else if (gapSq < mergeSq && !isLast) {
+                        rays.erase(front[i].ray);
+                        raysMerged++;
+                        continue;
+                    }
+                }
+                piece.push_back(front[i]);
+            }
+            finishPiece(piece);
+        }
+        fronts = std::move(refined);
+    }
+    
+    void clear() { fronts.clear(); }
+    
+    std::size_t getFrontCount() const { return fronts.size(); }
+    std::size_t getRaysInserted() const { return raysInserted; }
+    std::size_t getRaysMerged() const { return raysMerged; }
+};
+
+// ---------------------------------------------------------------------------
+// C API (see BlackHole.h)
+// ---------------------------------------------------------------------------
+
+// Headless scene behind the C interface: the hole, its rays and the threads
+// that step them, without any window
+struct bh_scene {
+    BlackHole hole;
+    RayStore rays;
+    WorkerPool pool;
+    KerrPhotonEngine kerrEngine;
+    bool useKerr = false;
+    // Used by rays spawned into this scene; the front end's globals are not
+    // touched, so scenes on different threads stay independent
+    PathStorage storage = PathStorage::Float;
+    TrailWindow trail;
+    
+    bh_scene(float mass, float spin, unsigned threads)
+        : hole(Vector2f(WINDOW_WIDTH / 2.0f, WINDOW_HEIGHT / 2.0f), mass, spin),
+          pool(threads ? threads : std::max(1u, std::thread::hardware_concurrency())) {}
+};
+
+namespace capi_detail {
+
+constexpr bh_ray_handle packHandle(RayHandle handle) {
+    return static_cast<bh_ray_handle>(handle.index) | (static_cast<bh_ray_handle>(handle.generation) << 32);
+}
+
+constexpr RayHandle unpackHandle(bh_ray_handle ray) {
+    return {static_cast<std::uint32_t>(ray), static_cast<std::uint32_t>(ray >> 32)};
+}
+
+// First index and count of a ray set within the [active | absorbed] order
+std::pair<std::size_t, std::size_t> setRange(const RayStore& rays, bh_ray_set set) {
+    switch (set) {
+        case BH_RAYS_ACTIVE: return {0, rays.activeCount()};
+        case BH_RAYS_ABSORBED: return {rays.activeCount(), rays.absorbedCount()};
+        default: return {0, rays.size()};
+    }
+}
+
+// View of one Vector2f field of every ray in the range, read in place
+template <typename Field>
+bh_view fieldView(const RayStore& rays, bh_ray_set set, Field field) {
+    auto range = setRange(rays, set);
+    if (range.second == 0) return {nullptr, 0, sizeof(LightRay), BH_FORMAT_F32X2};
+    return {&field(rays[range.first]), range.second, sizeof(LightRay), BH_FORMAT_F32X2};
+}
+
+// count trajectory points from storage slot start, in the path's own format
+bh_view pathView(const RayPath& path, std::size_t start, std::size_t count) {
+    if (path.getStorage() == PathStorage::Quantized) {
+        return {path.packedPoints().data() + start, count, sizeof(PackedPoint), BH_FORMAT_I16X2_FIXED};
+    }
+    return {path.floatPoints().data() + start, count, sizeof(Vector2f), BH_FORMAT_F32X2};
+}
+
+}  // namespace capi_detail
+
+extern "C" {
+
+uint32_t bh_api_version(void) { return BH_API_VERSION; }
+
+uint32_t bh_features(void) {
+    return (TRACK_SHAPIRO_DELAY ? BH_FEATURE_SHAPIRO_DELAY : 0u) | (TRACK_REDSHIFT ? BH_FEATURE_REDSHIFT : 0u);
+}
+
+bh_scene* bh_scene_create(float mass, float spin, unsigned threads) {
+    try {
+        return new bh_scene(mass, spin, threads);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void bh_scene_destroy(bh_scene* scene) { delete scene; }
+
+void bh_scene_reset(bh_scene* scene) {
+    if (scene) scene->rays.clear();
+}
+
+void bh_scene_set_hole(bh_scene* scene, float x, float y, float mass, float spin) {
+    if (!scene) return;
+    scene->hole.setPosition(Vector2f(x, y));
+    scene->hole.setMass(mass);
+    scene->hole.setSpin(spin);
+}
+
+void bh_scene_set_kerr(bh_scene* scene, int kerr) {
+    if (scene) scene->useKerr = kerr != 0;
+}
+
+bh_ray_handle bh_scene_spawn_ray(bh_scene* scene, float x, float y, float vx, float vy) {
+    if (!scene) return BH_INVALID_RAY;
+    try {
+        RayHandle handle = scene->rays.emplace(Vector2f(x, y), Vector2f(vx, vy), sf::Color::White, scene->storage, scene->trail);
+        scene->rays.get(handle)->setEmitter(scene->hole);
+        return capi_detail::packHandle(handle);
+    } catch (...) {
+        return BH_INVALID_RAY;
+    }
+}
+
+unsigned bh_scene_step(bh_scene* scene, float dt, unsigned steps) {
+    if (!scene) return 0;
+    unsigned completed = 0;
+    try {
+        for (; completed < steps; completed++) {
+            stepRays(scene->pool, scene->rays, scene->hole, scene->useKerr ? &scene->kerrEngine : nullptr, dt);
+        }
+    } catch (...) {
+        // Trajectory growth failed to allocate on some worker; the pool has
+        // joined every worker before rethrowing, so stop at this step. Rays
+        // the failed step already moved keep their new state.
+    }
+    return completed;
+}
+
+size_t bh_scene_ray_count(const bh_scene* scene, bh_ray_set set) {
+    return scene ? capi_detail::setRange(scene->rays, set).second : 0;
+}
+
+int64_t bh_scene_ray_index(const bh_scene* scene, bh_ray_handle ray) {
+    RayHandle handle = capi_detail::unpackHandle(ray);
+    if (!scene || !scene->rays.contains(handle)) return -1;
+    return static_cast<int64_t>(scene->rays.indexOf(handle));
+}
+
+bh_ray_handle bh_scene_ray_handle(const bh_scene* scene, size_t index) {
+    if (!scene || index >= scene->rays.size()) return BH_INVALID_RAY;
+    return capi_detail::packHandle(scene->rays.handleAt(index));
+}
+
+bh_view bh_scene_positions(const bh_scene* scene, bh_ray_set set) {
+    if (!scene) return {nullptr, 0, 0, BH_FORMAT_NONE};
+    return capi_detail::fieldView(scene->rays, set, [](const LightRay& ray) -> const Vector2f& { return ray.getPosition(); });
+}
+
+bh_view bh_scene_velocities(const bh_scene* scene, bh_ray_set set) {
+    if (!scene) return {nullptr, 0, 0, BH_FORMAT_NONE};
+    return capi_detail::fieldView(scene->rays, set, [](const LightRay& ray) -> const Vector2f& { return ray.getVelocity(); });
+}
+
+bh_view bh_scene_ray_path(const bh_scene* scene, size_t index) {
+    if (!scene || index >= scene->rays.size()) return {nullptr, 0, 0, BH_FORMAT_NONE};
+    const RayPath& path = scene->rays[index].getPath();
+    PathSlots slots = path.slots();
+    return capi_detail::pathView(path, slots.start, slots.firstCount);
+}
+
+bh_view bh_scene_ray_path_wrapped(const bh_scene* scene, size_t index) {
+    if (!scene || index >= scene->rays.size()) return {nullptr, 0, 0, BH_FORMAT_NONE};
+    const RayPath& path = scene->rays[index].getPath();
+    return capi_detail::pathView(path, 0, path.slots().secondCount);
+}
+
+float bh_scene_ray_shapiro_delay(const bh_scene* scene, size_t index) {
+    if (!scene || index >= scene->rays.size()) return 0.0f;
+    return scene->rays[index].getShapiroDelay();
+}
+
+float bh_scene_ray_redshift(const bh_scene* scene, size_t index) {
+    if (!scene || index >= scene->rays.size()) return 0.0f;
+    return scene->rays[index].getRedshift();
+}
+
+uint64_t bh_scene_ray_path_first(const bh_scene* scene, size_t index) {
+    if (!scene || index >= scene->rays.size()) return 0;
+    return scene->rays[index].getPath().firstIndex();
+}
+
+bh_view bh_scene_ray_path_chunks(const bh_scene* scene, size_t index) {
+    if (!scene || index >= scene->rays.size()) return {nullptr, 0, 0, BH_FORMAT_NONE};
+    const std::vector<PathChunk>& chunks = scene->rays[index].getPath().pathChunks();
+    return {chunks.data(), chunks.size(), sizeof(PathChunk), BH_FORMAT_PATH_CHUNK};
+}
+
+void bh_scene_set_path_storage(bh_scene* scene, int quantized) {
+    if (scene) scene->storage = quantized ? PathStorage::Quantized : PathStorage::Float;
+}
+
+void bh_scene_set_trail_window(bh_scene* scene, uint32_t points, float seconds) {
+    if (scene) scene->trail = {points, std::max(seconds, 0.0f)};
+}
+
+}  // extern "C"
+
+// ---------------------------------------------------------------------------
+// Metrics
+// ---------------------------------------------------------------------------
+
+// Histogram written by a single thread and read by any other. A sequence
+// counter (seqlock) lets readers detect and retry a torn snapshot, so the
+// writer never waits; every field is an atomic to keep the races defined.
+class FrameHistogram {
+public:
+    static constexpr std::array<double, 11> BOUNDS = {
+        0.001, 0.002, 0.004, 0.008, 0.016, 0.033, 0.066, 0.133, 0.25, 0.5, 1.0};
+    
+    struct Snapshot {
+        std::array<std::uint64_t, BOUNDS.size() + 1> buckets{};   // last is +Inf
+        double sum = 0.0;
+        std::uint64_t count = 0;
+    };
+    
+private:
+    std::atomic<std::uint32_t> sequence{0};
+    std::array<std::atomic<std::uint64_t>, BOUNDS.size() + 1> buckets{};
+    std::atomic<double> sum{0.0};
+    std::atomic<std::uint64_t> count{0};
+    
+public:
+    void observe(double seconds) {
+        std::size_t bucket = std::lower_bound(BOUNDS.begin(), BOUNDS.end(), seconds) - BOUNDS.begin();
+        // Release stores on the fields order them after the odd sequence, so
+        // a reader that sees any new value also sees the write in progress
+        std::uint32_t s = sequence.load(std::memory_order_relaxed);
+        sequence.store(s + 1, std::memory_order_relaxed);
+        buckets[bucket].store(buckets[bucket].load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        sum.store(sum.load(std::memory_order_relaxed) + seconds, std::memory_order_release);
+        count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        sequence.store(s + 2, std::memory_order_release);
+    }
+    
+    Snapshot read() const {
+        Snapshot snapshot;
+        for (;;) {
+            std::uint32_t before = sequence.load(std::memory_order_acquire);
+            if (before & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+            for (std::size_t i = 0; i < buckets.size(); i++) {
+                snapshot.buckets[i] = buckets[i].load(std::memory_order_acquire);
+            }
+            snapshot.sum = sum.load(std::memory_order_acquire);
+            snapshot.count = count.load(std::memory_order_acquire);
+            if (sequence.load(std::memory_order_relaxed) == before) return snapshot;
+        }
+    }
+};
+
+// Values published by the simulation loop for the metrics endpoint. The loop
+// only performs relaxed stores; allocation totals come from memory_detail.
+struct SimulationMetrics {
+    bool enabled = false;
+    FrameHistogram frameSeconds;        // interval between frames
+    FrameHistogram stepSeconds;         // time spent in the physics step
+    FrameHistogram inputLatencySeconds; // input polled to frame presented
+    std::atomic<std::uint64_t> raySteps{0};
+    std::atomic<std::uint64_t> raysEscaped{0};
+    std::atomic<double> raysPerSecond{0.0};
+    std::atomic<std::uint64_t> activeRays{0};
+    std::atomic<std::uint64_t> absorbedRays{0};
+    std::atomic<std::uint64_t> pathBytes{0};
+    std::atomic<std::uint64_t> pathPoints{0};
+    
+    // Single-writer counters: plain load + store, no read-modify-write
+    static void add(std::atomic<std::uint64_t>& counter, std::uint64_t amount) {
+        counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+};
+
+inline SimulationMetrics& metrics() {
+    static SimulationMetrics instance;
+    return instance;
+}
+
+// Prometheus text exposition format, version 0.0.4
+std::string renderMetrics(const SimulationMetrics& m) {
+    std::string out;
+    auto header = [&](const char* name, const char* type, const char* help) {
+        out += std::string("# HELP ") + name + " " + help + "\n# TYPE " + name + " " + type + "\n";
+    };
+    // Counters print as integers; doubles keep enough digits for rate()
+    auto value = [&](const char* name, auto v) {
+        std::ostringstream line;
+        line.precision(12);
+        line << name << " " << v << "\n";
+        out += line.str();
+    };
+    auto histogram = [&](const char* name, const char* help, const FrameHistogram& h) {
+        header(name, "histogram", help);
+        FrameHistogram::Snapshot snapshot = h.read();
+        std::uint64_t cumulative = 0;
+        std::ostringstream lines;
+        lines.precision(12);
+        for (std::size_t i = 0; i < snapshot.buckets.size(); i++) {
+            cumulative += snapshot.buckets[i];
+            lines << name << "_bucket{le=\"";
+            if (i < FrameHistogram::BOUNDS.size()) lines << FrameHistogram::BOUNDS[i];
+            else lines << "+Inf";
+            lines << "\"} " << cumulative << "\n";
+        }
+        lines << name << "_sum " << snapshot.sum << "\n" << name << "_count " << snapshot.count << "\n";
+        out += lines.str();
+    };
+    auto relaxed = [](const auto& atomic) { return atomic.load(std::memory_order_relaxed); };
+    
+    histogram("blackhole_frame_seconds", "Interval between simulation frames.", m.frameSeconds);
+    histogram("blackhole_step_seconds", "Time spent in the physics step per frame.", m.stepSeconds);
+    histogram("blackhole_input_latency_seconds", "Time from polling an input event to presenting its frame.", m.inputLatencySeconds);
+    header("blackhole_ray_steps_total", "counter", "Ray integration steps performed.");
+    value("blackhole_ray_steps_total", relaxed(m.raySteps));
+    header("blackhole_rays_per_second", "gauge", "Ray steps per second, smoothed over recent frames.");
+    value("blackhole_rays_per_second", relaxed(m.raysPerSecond));
+    header("blackhole_rays_active", "gauge", "Rays still being integrated.");
+    value("blackhole_rays_active", relaxed(m.activeRays));
+    header("blackhole_rays_absorbed", "gauge", "Rays kept after crossing the horizon.");
+    value("blackhole_rays_absorbed", relaxed(m.absorbedRays));
+    header("blackhole_rays_escaped_total", "counter", "Rays removed after leaving the screen.");
+    value("blackhole_rays_escaped_total", relaxed(m.raysEscaped));
+    header("blackhole_path_points", "gauge", "Trajectory points held by live rays.");
+    value("blackhole_path_points", relaxed(m.pathPoints));
+    header("blackhole_path_bytes", "gauge", "Trajectory storage reserved by live rays.");
+    value("blackhole_path_bytes", relaxed(m.pathBytes));
+    header("blackhole_allocations_total", "counter", "Ray and trajectory allocations.");
+    value("blackhole_allocations_total", relaxed(memory_detail::allocations));
+    header("blackhole_allocated_bytes_total", "counter", "Bytes allocated for rays and trajectories.");
+    value("blackhole_allocated_bytes_total", relaxed(memory_detail::allocatedBytes));
+    header("blackhole_freed_bytes_total", "counter", "Bytes released by rays and trajectories.");
+    value("blackhole_freed_bytes_total", relaxed(memory_detail::freedBytes));
+    return out;
+}
+
+// Serves renderMetrics() over HTTP on a loopback TCP port or a Unix socket
+// from its own thread. It only reads published atomics, so a slow or stuck
+// scraper can never hold up the simulation.
+class MetricsServer {
+private:
+    int listenSocket = -1;
+    std::string unixPath;
+    std::thread thread;
+    std::atomic<bool> running{false};
+    
+#if defined(__unix__) || defined(__APPLE__)
+    static void sendAll(int socket, const std::string& data) {
+#ifdef MSG_NOSIGNAL
+        const int flags = MSG_NOSIGNAL;
+#else
+        const int flags = 0;
+#endif
+        std::size_t sent = 0;
+        while (sent < data.size()) {
+            ssize_t n = send(socket, data.data() + sent, data.size() - sent, flags);
+            if (n <= 0) return;
+            sent += static_cast<std::size_t>(n);
+        }
+    }
+    
+    void serve() {
+        int backoffMs = 1;
+        while (running.load()) {
+            int client = accept(listenSocket, nullptr, nullptr);
+            if (client < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                    // Out of descriptors or memory: the pending connection
+                    // stays queued, so retrying at once would spin. Wait with
+                    // a capped exponential backoff for resources to free up.
+                    std::this_thread::sleep_for(std::chrono::milliseconds(backoffMs));
+                    backoffMs = std::min(backoffMs * 2, 256);
+                    continue;
+                }
+                // The listening socket is gone (closed by stop()) or broken
+                return;
+            }
+            backoffMs = 1;
+            
+            // A scraper that never sends its request, or stops reading the
+            // response, cannot stall us for long
+            timeval timeout{1, 0};
+            setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            char request[2048];
+            ssize_t received = recv(client, request, sizeof(request) - 1, 0);
+            if (received > 0) {
+                request[received] = 0;
+                bool found = std::strncmp(request, "GET /metrics", 12) == 0 || std::strncmp(request, "GET / ", 6) == 0;
+                std::string body = found ? renderMetrics(metrics()) : "not found\n";
+                std::string response = std::string(found ? "HTTP/1.1 200 OK" : "HTTP/1.1 404 Not Found") +
+                    "\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + std::to_string(body.size()) +
+                    "\r\nConnection: close\r\n\r\n" + body;
+                sendAll(client, response);
+            }
+            close(client);
+        }
+    }
+    
+    bool start(int socket) {
+        if (running.load() || listen(socket, 8) != 0) {
+            close(socket);
+            return false;
+        }
+        listenSocket = socket;
+        running = true;
+        metrics().enabled = true;
+        thread = std::thread([this] { serve(); });
+        return true;
+    }
+#endif
+    
+public:
+    MetricsServer() = default;
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+    ~MetricsServer() { stop(); }
+    
+    // Binds 127.0.0.1 only; the endpoint is meant for a local scraper
+    bool listenTcp(std::uint16_t port) {
+#if defined(__unix__) || defined(__APPLE__)
+        int socket = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (socket < 0) return false;
+        int reuse = 1;
+        setsockopt(socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            close(socket);
+            return false;
+        }
+        return start(socket);
+#else
+        (void)port;
+        return false;
+#endif
+    }
+    
+    bool listenUnix(const std::string& path) {
+#if defined(__unix__) || defined(__APPLE__)
+        sockaddr_un address{};
+        if (path.size() >= sizeof(address.sun_path)) return false;
+        int socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (socket < 0) return false;
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        unlink(path.c_str());
+        if (bind(socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            close(socket);
+            return false;
+        }
+        unixPath = path;
+        return start(socket);
+#else
+        (void)path;
+        return false;
+#endif
+    }
+    
+    void stop() {
+#if defined(__unix__) || defined(__APPLE__)
+        if (!running.exchange(false)) return;
+        // Wakes the blocking accept()
+        shutdown(listenSocket, SHUT_RDWR);
+        close(listenSocket);
+        thread.join();
+        if (!unixPath.empty()) unlink(unixPath.c_str());
+        metrics().enabled = false;
+#endif
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Asynchronous export I/O
+// ---------------------------------------------------------------------------
+
+// Prefer io_uring for exports; cleared by --no-io-uring to force the
+// pwrite fallback
+inline bool& ioUringAllowed() {
+    static bool allowed = true;
+    return allowed;
+}
+
+#if BH_HAVE_IO_URING
+// Bare io_uring over raw syscalls: the submission ring, completion ring and
+// SQE array mapped once. Only the export I/O thread touches it.
+class IoUring {
+    int fd = -1;
+    void* sqMap = MAP_FAILED;
+    void* cqMap = MAP_FAILED;
+    std::size_t sqMapBytes = 0;
+    std::size_t cqMapBytes = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    std::size_t sqesBytes = 0;
+    unsigned* sqHead = nullptr;
+    unsigned* sqTail = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned sqMask = 0;
+    unsigned sqEntries = 0;
+    unsigned sqPending = 0;     // SQEs filled but not yet published
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    io_uring_cqe* cqes = nullptr;
+    unsigned cqMask = 0;
+    
+    template <typename T>
+    static T* at(void* base, unsigned offset) {
+        return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+    }
+    
+public:
+    IoUring() = default;
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+    
+    ~IoUring() {
+        if (sqes != MAP_FAILED) munmap(sqes, sqesBytes);
+        if (cqMap != MAP_FAILED && cqMap != sqMap) munmap(cqMap, cqMapBytes);
+        if (sqMap != MAP_FAILED) munmap(sqMap, sqMapBytes);
+        if (fd >= 0) ::close(fd);
+    }
+    
+    bool setup(unsigned entries) {
+        io_uring_params params{};
+        fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (fd < 0) return false;
+        
+        sqMapBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqMapBytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMap) sqMapBytes = cqMapBytes = std::max(sqMapBytes, cqMapBytes);
+        sqMap = mmap(nullptr, sqMapBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sqMap == MAP_FAILED) return false;
+        cqMap = singleMap ? sqMap
+                          : mmap(nullptr, cqMapBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cqMap == MAP_FAILED) return false;
+        sqesBytes = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(
+            mmap(nullptr, sqesBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+        if (sqes == MAP_FAILED) return false;
+        
+        sqHead = at<unsigned>(sqMap, params.sq_off.head);
+        sqTail = at<unsigned>(sqMap, params.sq_off.tail);
+        sqArray = at<unsigned>(sqMap, params.sq_off.array);
+        sqMask = *at<unsigned>(sqMap, params.sq_off.ring_mask);
+        sqEntries = params.sq_entries;
+        cqHead = at<unsigned>(cqMap, params.cq_off.head);
+        cqTail = at<unsigned>(cqMap, params.cq_off.tail);
+        cqes = at<io_uring_cqe>(cqMap, params.cq_off.cqes);
+        cqMask = *at<unsigned>(cqMap, params.cq_off.ring_mask);
+        return true;
+    }
+    
+    // Pins the buffers so WRITE_FIXED skips the per-request page mapping
+    bool registerBuffers(const std::vector<iovec>& buffers) {
+        return syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, buffers.data(),
+                       static_cast<unsigned>(buffers.size())) == 0;
+    }
+    
+    // Next free SQE, cleared; null when the ring is full
+    io_uring_sqe* nextSqe() {
+        unsigned tail = *sqTail + sqPending;
+        if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) return nullptr;
+        unsigned index = tail & sqMask;
+        sqArray[index] = index;
+        sqPending++;
+        std::memset(&sqes[index], 0, sizeof(io_uring_sqe));
+        return &sqes[index];
+    }
+    
+    // Publishes every filled SQE in one syscall, optionally waiting for
+    // completions. Returns false on a hard error.
+    bool submit(unsigned waitFor) {
+        unsigned tail = *sqTail + sqPending;
+        __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+        sqPending = 0;
+        // Includes entries an earlier EBUSY left unconsumed
+        unsigned count = tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+        for (;;) {
+            long result = syscall(__NR_io_uring_enter, fd, count, waitFor, waitFor ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            if (result >= 0) return true;
+            if (errno == EAGAIN || errno == EBUSY) return true;     // retried once completions drain
+            if (errno != EINTR) return false;
+        }
+    }
+    
+    template <typename Fn>
+    unsigned reap(Fn&& fn) {
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        unsigned count = tail - head;
+        for (; head != tail; head++) fn(cqes[head & cqMask]);
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        return count;
+    }
+};
+#endif
+
+// Writes export files off the simulation thread. Callers copy data into a
+// pool of fixed buffers and return at once; full buffers and, on submit(),
+// partial ones are handed to a dedicated I/O thread. With io_uring that
+// thread batches every ready buffer into one submission of WRITE_FIXED
+// requests on registered buffers and reaps completions; otherwise a small
+// pool of threads issues positional writes. Callers only wait when every
+// buffer is in flight, and that time is counted as a stall.
+class ExportWriter {
+public:
+    static constexpr std::size_t BUFFER_BYTES = 1 << 20;
+    static constexpr unsigned BUFFER_COUNT = 32;
+    
+    enum class Backend { IoUring, ThreadPool };
+    
+private:
+#if defined(__unix__) || defined(__APPLE__)
+    using NativeFile = int;
+    static constexpr int NO_FILE = -1;
+#else
+    using NativeFile = std::FILE*;
+    static constexpr std::FILE* NO_FILE = nullptr;
+#endif
+    
+    struct File {
+        NativeFile handle = NO_FILE;
+        std::uint64_t offset = 0;       // where the next buffer goes
+        int openBuffer = -1;
+        std::size_t fill = 0;
+        unsigned pending = 0;           // buffers queued or in flight
+        bool closing = false;
+        bool failed = false;
+    };
+    
+    // A buffer's write: file range and how much has landed
+    struct Request {
+        int file;
+        std::uint64_t offset;
+        std::size_t length;
+        std::size_t done;
+    };
+    
+    std::vector<std::unique_ptr<char[]>> buffers;
+    std::vector<Request> requests;      // indexed by buffer
+    std::vector<unsigned> freeBuffers;
+    std::deque<unsigned> ready;         // buffers waiting for the I/O thread
+    std::vector<File> files;
+    std::mutex mutex;
+    std::condition_variable workReady;
+    std::condition_variable bufferFreed;
+    std::vector<std::thread> threads;
+    bool stopping = false;
+    Backend backend = Backend::ThreadPool;
+#if BH_HAVE_IO_URING
+    IoUring ring;
+    bool registeredBuffers = false;
+#endif
+    std::atomic<std::uint64_t> bytesWritten{0};
+    std::atomic<std::uint64_t> writeErrors{0};
+    std::atomic<std::uint64_t> submissions{0};
+    std::atomic<std::uint64_t> stallNanoseconds{0};
+    
+    static NativeFile openNative(const std::string& path) {
+#if defined(__unix__) || defined(__APPLE__)
+        return ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#else
+        return std::fopen(path.c_str(), "wb");
+#endif
+    }
+    
+    static void closeNative(NativeFile handle) {
+#if defined(__unix__) || defined(__APPLE__)
+        ::close(handle);
+#else
+        std::fclose(handle);
+#endif
+    }
+    
+    // Bytes written, or -errno; the non-POSIX path has a single writer thread
+    static long writeAt(NativeFile handle, const char* data, std::size_t bytes, std::uint64_t offset) {
+#if defined(__unix__) || defined(__APPLE__)
+        long written = static_cast<long>(::pwrite(handle, data, bytes, static_cast<off_t>(offset)));
+        return written < 0 ? -errno : written;
+#elif defined(_WIN32)
+        if (_fseeki64(handle, static_cast<long long>(offset), SEEK_SET) != 0) return -EIO;
+        std::size_t written = std::fwrite(data, 1, bytes, handle);
+        return written ? static_cast<long>(written) : -EIO;
+#else
+        if (std::fseek(handle, static_cast<long>(offset), SEEK_SET) != 0) return -EIO;
+        std::size_t written = std::fwrite(data, 1, bytes, handle);
+        return written ? static_cast<long>(written) : -EIO;
+#endif
+    }
+    
+    // Takes a free buffer, waiting (and counting the stall) if none is left
+    unsigned takeBuffer(std::unique_lock<std::mutex>& lock) {
+        if (freeBuffers.empty()) {
+            auto start = std::chrono::steady_clock::now();
+            bufferFreed.wait(lock, [&]() { return !freeBuffers.empty(); });
+            stallNanoseconds.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+        }
+        unsigned buffer = freeBuffers.back();
+        freeBuffers.pop_back();
+        return buffer;
+    }
+    
+    // Queues the file's open buffer; caller notifies the I/O thread
+    void queueOpenBuffer(int id) {
+        File& file = files[id];
+        if (file.openBuffer < 0) return;
+        unsigned buffer = static_cast<unsigned>(file.openBuffer);
+        requests[buffer] = {id, file.offset, file.fill, 0};
+        file.offset += file.fill;
+        file.openBuffer = -1;
+        file.fill = 0;
+        ready.push_back(buffer);
+    }
+    
+    void closeIfDone(File& file) {
+        if (!file.closing || file.pending || file.openBuffer >= 0 || file.handle == NO_FILE) return;
+        closeNative(file.handle);
+        file.handle = NO_FILE;
+    }
+    
+    // Completion of one write attempt. Returns true when the buffer went back
+    // to the pool, false when the remainder was queued again.
+    bool complete(unsigned buffer, long result) {
+        Request& request = requests[buffer];
+        File& file = files[request.file];
+        if (result == -EINTR || result == -EAGAIN) {
+            ready.push_front(buffer);
+            return false;
+        }
+        if (result <= 0) {
+            file.failed = true;
+            writeErrors.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            request.done += static_cast<std::size_t>(result);
+            bytesWritten.fetch_add(static_cast<std::uint64_t>(result), std::memory_order_relaxed);
+            if (request.done < request.length) {
+                ready.push_front(buffer);
+                return false;
+            }
+        }
+        file.pending--;
+        closeIfDone(file);
+        freeBuffers.push_back(buffer);
+        bufferFreed.notify_all();
+        return true;
+    }
+    
+#if BH_HAVE_IO_URING
+    void uringLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        unsigned inFlight = 0;
+        std::vector<bool> submitted(BUFFER_COUNT);
+        for (;;) {
+            workReady.wait(lock, [&]() { return stopping || !ready.empty() || inFlight > 0; });
+            if (stopping && ready.empty() && inFlight == 0) return;
+            
+            // Everything ready goes out in one batch
+            unsigned batch = 0;
+            while (!ready.empty()) {
+                io_uring_sqe* sqe = ring.nextSqe();
+                if (!sqe) break;
+                unsigned buffer = ready.front();
+                ready.pop_front();
+                const Request& request = requests[buffer];
+                sqe->opcode = registeredBuffers ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+                sqe->fd = files[request.file].handle;
+                sqe->addr = reinterpret_cast<std::uint64_t>(buffers[buffer].get() + request.done);
+                sqe->len = static_cast<std::uint32_t>(request.length - request.done);
+                sqe->off = request.offset + request.done;
+                sqe->buf_index = static_cast<std::uint16_t>(buffer);
+                sqe->user_data = buffer;
+                submitted[buffer] = true;
+                batch++;
+            }
+            inFlight += batch;
+            lock.unlock();
+            bool accepted = ring.submit(1);
+            lock.lock();
+            if (batch) submissions.fetch_add(1, std::memory_order_relaxed);
+            inFlight -= ring.reap([&](const io_uring_cqe& cqe) {
+                submitted[cqe.user_data] = false;
+                complete(static_cast<unsigned>(cqe.user_data), cqe.res);
+            });
+            if (!accepted) {
+                // The ring is unusable: fail whatever it still holds rather than wait forever
+                for (unsigned buffer = 0; buffer < BUFFER_COUNT; buffer++) {
+                    if (!submitted[buffer]) continue;
+                    submitted[buffer] = false;
+                    complete(buffer, -EIO);
+                }
+                inFlight = 0;
+            }
+        }
+    }
+#endif
+    
+    void poolLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            workReady.wait(lock, [&]() { return stopping || !ready.empty(); });
+            if (ready.empty()) return;
+            unsigned buffer = ready.front();
+            ready.pop_front();
+            Request request = requests[buffer];
+            NativeFile handle = files[request.file].handle;
+            lock.unlock();
+            long result = writeAt(handle, buffers[buffer].get() + request.done, request.length - request.done,
+                                  request.offset + request.done);
+            lock.lock();
+            submissions.fetch_add(1, std::memory_order_relaxed);
+            complete(buffer, result);
+        }
+    }
+    
+public:
+    explicit ExportWriter(bool allowIoUring = ioUringAllowed(), unsigned poolThreads = 2) {
+        buffers.reserve(BUFFER_COUNT);
+        for (unsigned i = 0; i < BUFFER_COUNT; i++) {
+            buffers.emplace_back(new char[BUFFER_BYTES]);
+            freeBuffers.push_back(BUFFER_COUNT - 1 - i);
+        }
+        requests.resize(BUFFER_COUNT);
+        
+#if BH_HAVE_IO_URING
+        if (allowIoUring && ring.setup(BUFFER_COUNT)) {
+            std::vector<iovec> iov;
+            for (auto& buffer : buffers) iov.push_back({buffer.get(), BUFFER_BYTES});
+            // Registration can fail under RLIMIT_MEMLOCK; plain WRITE still works
+            registeredBuffers = ring.registerBuffers(iov);
+            backend = Backend::IoUring;
+            threads.emplace_back([this]() { uringLoop(); });
+            return;
+        }
+#else
+        (void)allowIoUring;
+#endif
+#if !defined(__unix__) && !defined(__APPLE__)
+        poolThreads = 1;    // stdio positions are per stream
+#endif
+        for (unsigned i = 0; i < std::max(1u, poolThreads); i++) {
+            threads.emplace_back([this]() { poolLoop(); });
+        }
+    }
+    
+    ~ExportWriter() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (std::size_t id = 0; id < files.size(); id++) {
+                queueOpenBuffer(static_cast<int>(id));
+                files[id].closing = true;
+            }
+            stopping = true;
+        }
+        workReady.notify_all();
+        for (auto& thread : threads) thread.join();
+        for (File& file : files) {
+            if (file.handle != NO_FILE) closeNative(file.handle);
+        }
+    }
+    
+    ExportWriter(const ExportWriter&) = delete;
+    ExportWriter& operator=(const ExportWriter&) = delete;
+    
+    // Truncates or creates the file; returns its id, or -1
+    int open(const std::string& path) {
+        NativeFile handle = openNative(path);
+        if (handle == NO_FILE) return -1;
+        std::lock_guard<std::mutex> lock(mutex);
+        std::size_t id = 0;
+        while (id < files.size() && (files[id].handle != NO_FILE || files[id].pending)) id++;
+        if (id == files.size()) files.emplace_back();
+        files[id] = File();
+        files[id].handle = handle;
+        return static_cast<int>(id);
+    }
+    
+    // Copies bytes to the end of the file's queued data
+    void append(int id, const void* data, std::size_t bytes) {
+        const char* source = static_cast<const char*>(data);
+        std::unique_lock<std::mutex> lock(mutex);
+        bool queued = false;
+        while (bytes > 0) {
+            File& file = files[id];
+            if (file.openBuffer < 0) {
+                unsigned buffer = takeBuffer(lock);
+                // open() may have grown files while we waited; index again
+                files[id].openBuffer = static_cast<int>(buffer);
+                files[id].pending++;
+                continue;
+            }
+            std::size_t count = std::min(bytes, BUFFER_BYTES - file.fill);
+            std::memcpy(buffers[file.openBuffer].get() + file.fill, source, count);
+            file.fill += count;
+            source += count;
+            bytes -= count;
+            if (file.fill == BUFFER_BYTES) {
+                queueOpenBuffer(id);
+                queued = true;
+            }
+        }
+        if (queued) workReady.notify_all();
+    }
+    
+    // Hands every partially filled buffer to the I/O thread as one batch
+    void submit() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (std::size_t id = 0; id < files.size(); id++) queueOpenBuffer(static_cast<int>(id));
+        }
+        workReady.notify_all();
+    }
+    
+    // The file closes once its queued writes have landed
+    void close(int id) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queueOpenBuffer(id);
+            files[id].closing = true;
+            closeIfDone(files[id]);
+        }
+        workReady.notify_all();
+    }
+    
+    // Whole-file convenience: open, copy, close
+    bool writeFile(const std::string& path, const std::string& contents) {
+        int id = open(path);
+        if (id < 0) return false;
+        append(id, contents.data(), contents.size());
+        close(id);
+        return true;
+    }
+    
+    // Blocks until every queued byte has been written
+    void flush() {
+        submit();
+        std::unique_lock<std::mutex> lock(mutex);
+        bufferFreed.wait(lock, [&]() {
+            if (freeBuffers.size() != BUFFER_COUNT) return false;
+            return std::none_of(files.begin(), files.end(), [](const File& f) { return f.openBuffer >= 0; });
+        });
+    }
+    
+    bool failed(int id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return files[id].failed;
+    }
+    
+    Backend getBackend() const { return backend; }
+    const char* backendName() const {
+#if BH_HAVE_IO_URING
+        if (backend == Backend::IoUring) return registeredBuffers ? "io_uring (registered buffers)" : "io_uring";
+#endif
+        return "pwrite pool";
+    }
+    std::uint64_t getBytesWritten() const { return bytesWritten.load(std::memory_order_relaxed); }
+    std::uint64_t getWriteErrors() const { return writeErrors.load(std::memory_order_relaxed); }
+    std::uint64_t getSubmissions() const { return submissions.load(std::memory_order_relaxed); }
+    double getStallSeconds() const { return stallNanoseconds.load(std::memory_order_relaxed) * 1e-9; }
+};
+
+// Appends one binary record per frame: uint64 frame, uint64 ray count,
+// uint64 fields, then for every ray in store order (active first) x, y, vx,
+// vy as float32, followed by the Shapiro delay in seconds if fields has
+// BH_FEATURE_SHAPIRO_DELAY and the redshift z if it has BH_FEATURE_REDSHIFT.
+// Those columns exist only in builds that track them.
+class RayStateDump {
+    static constexpr std::size_t COLUMNS = 4 + TRACK_SHAPIRO_DELAY + TRACK_REDSHIFT;
+    
+    ExportWriter& writer;
+    int file;
+    std::uint64_t frame = 0;
+    std::vector<float> record;
+    
+public:
+    RayStateDump(ExportWriter& writer, const std::string& path) : writer(writer), file(writer.open(path)) {}
+    ~RayStateDump() {
+        if (file >= 0) writer.close(file);
+    }
+    
+    bool isOpen() const { return file >= 0; }
+    
+    void write(const RayStore& rays) {
+        if (file < 0) return;
+        std::uint64_t header[3] = {frame++, rays.size(), bh_features()};
+        record.resize(rays.size() * COLUMNS);
+        for (std::size_t i = 0; i < rays.size(); i++) {
+            const LightRay& ray = rays[i];
+            float* out = &record[i * COLUMNS];
+            *out++ = ray.getPosition().x;
+            *out++ = ray.getPosition().y;
+            *out++ = ray.getVelocity().x;
+            *out++ = ray.getVelocity().y;
+            if (TRACK_SHAPIRO_DELAY) *out++ = ray.getShapiroDelay();
+            if (TRACK_REDSHIFT) *out++ = ray.getRedshift();
+        }
+        writer.append(file, header, sizeof(header));
+        writer.append(file, record.data(), record.size() * sizeof(float));
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Image encoding
+// ---------------------------------------------------------------------------
+
+enum class ImageFormat { Qoi, Png };
+
+// "Quite OK Image" format, version 1.0: one pass, no entropy coder, several
+// times faster than PNG at a similar size on flat rendered images
+void encodeQoi(const std::uint8_t* rgba, int width, int height, std::vector<std::uint8_t>& out) {
+    auto put32 = [&](std::uint32_t v) {
+        for (int shift = 24; shift >= 0; shift -= 8) out.push_back(static_cast<std::uint8_t>(v >> shift));
+    };
+    out.insert(out.end(), {'q', 'o', 'i', 'f'});
+    put32(static_cast<std::uint32_t>(width));
+    put32(static_cast<std::uint32_t>(height));
+    out.push_back(4);   // RGBA
+    out.push_back(0);   // sRGB with linear alpha
+    
+    std::array<std::uint32_t, 64> index{};
+    std::uint8_t previous[4] = {0, 0, 0, 255};
+    int run = 0;
+    std::size_t pixels = static_cast<std::size_t>(width) * height;
+    for (std::size_t i = 0; i < pixels; i++) {
+        const std::uint8_t* p = rgba + i * 4;
+        if (std::memcmp(p, previous, 4) == 0) {
+            if (++run == 62 || i + 1 == pixels) {
+                out.push_back(static_cast<std::uint8_t>(0xc0 | (run - 1)));
+                run = 0;
+            }
+            continue;
+        }
+        if (run > 0) {
+            out.push_back(static_cast<std::uint8_t>(0xc0 | (run - 1)));
+            run = 0;
+        }
+        std::uint32_t packed;
+        std::memcpy(&packed, p, 4);
+        int slot = (p[0] * 3 + p[1] * 5 + p[2] * 7 + p[3] * 11) % 64;
+        if (index[slot] == packed) {
+            out.push_back(static_cast<std::uint8_t>(slot));
+        } else {
+            index[slot] = packed;
+            if (p[3] == previous[3]) {
+                int dr = static_cast<std::int8_t>(p[0] - previous[0]);
+                int dg = static_cast<std::int8_t>(p[1] - previous[1]);
+                int db = static_cast<std::int8_t>(p[2] - previous[2]);
+                int drg = dr - dg, dbg = db - dg;
+                if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                    out.push_back(static_cast<std::uint8_t>(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+                } else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7) {
+                    out.push_back(static_cast<std::uint8_t>(0x80 | (dg + 32)));
+                    out.push_back(static_cast<std::uint8_t>((drg + 8) << 4 | (dbg + 8)));
+                } else {
+                    out.insert(out.end(), {0xfe, p[0], p[1], p[2]});
+                }
+            } else {
+                out.insert(out.end(), {0xff, p[0], p[1], p[2], p[3]});
+            }
+        }
+        std::memcpy(previous, p, 4);
+    }
+    out.insert(out.end(), {0, 0, 0, 0, 0, 0, 0, 1});
+}
+
+namespace png_detail {
+
+constexpr std::uint32_t ADLER_BASE = 65521;
+
+inline std::uint32_t adler32(const std::uint8_t* data, std::size_t size, std::uint32_t adler = 1) {
+    std::uint32_t a = adler & 0xffff, b = adler >> 16;
+    while (size > 0) {
+        // 5552 bytes is the longest run before the sums can overflow 32 bits
+        std::size_t block = std::min<std::size_t>(size, 5552);
+        for (std::size_t i = 0; i < block; i++) {
+            a += data[i];
+            b += a;
+        }
+        a %= ADLER_BASE;
+        b %= ADLER_BASE;
+        data += block;
+        size -= block;
+    }
+    return a | b << 16;
+}
+
+// Adler-32 of A followed by B from the checksums of each (as in zlib)
+inline std::uint32_t adler32Combine(std::uint32_t first, std::uint32_t second, std::size_t secondSize) {
+    std::uint32_t remainder = static_cast<std::uint32_t>(secondSize % ADLER_BASE);
+    std::uint32_t a = first & 0xffff;
+    std::uint32_t b = static_cast<std::uint32_t>((static_cast<std::uint64_t>(remainder) * a) % ADLER_BASE);
+    a += (second & 0xffff) + ADLER_BASE - 1;
+    b += (first >> 16) + (second >> 16) + ADLER_BASE - remainder;
+    if (a >= ADLER_BASE) a -= ADLER_BASE;
+    if (a >= ADLER_BASE) a -= ADLER_BASE;
+    if (b >= 2 * ADLER_BASE) b -= 2 * ADLER_BASE;
+    if (b >= ADLER_BASE) b -= ADLER_BASE;
+    return a | b << 16;
+}
+
+inline std::uint32_t crc32(const std::uint8_t* data, std::size_t size, std::uint32_t crc = 0) {
+    static const std::array<std::uint32_t, 256> table = []() {
+        std::array<std::uint32_t, 256> t{};
+        for (std::uint32_t n = 0; n < 256; n++) {
+            std::uint32_t c = n;
+            for (int k = 0; k < 8; k++) c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            t[n] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (std::size_t i = 0; i < size; i++) crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+// LSB-first bit packer for deflate streams
+class BitWriter {
+    std::vector<std::uint8_t>& out;
+    std::uint64_t bits = 0;
+    int count = 0;
+    
+public:
+    explicit BitWriter(std::vector<std::uint8_t>& out) : out(out) {}
+    
+    void put(std::uint32_t value, int length) {
+        bits |= static_cast<std::uint64_t>(value) << count;
+        count += length;
+        while (count >= 8) {
+            out.push_back(static_cast<std::uint8_t>(bits));
+            bits >>= 8;
+            count -= 8;
+        }
+    }
+    
+    // Huffman codes are defined MSB first
+    void putCode(std::uint32_t code, int length) {
+        std::uint32_t reversed = 0;
+        for (int i = 0; i < length; i++) reversed |= ((code >> i) & 1) << (length - 1 - i);
+        put(reversed, length);
+    }
+    
+    void alignToByte() {
+        if (count > 0) put(0, 8 - count);
+    }
+};
+
+inline void putLiteral(BitWriter& bits, int symbol) {
+    if (symbol < 144) bits.putCode(0x30 + symbol, 8);
+    else if (symbol < 256) bits.putCode(0x190 + symbol - 144, 9);
+    else if (symbol < 280) bits.putCode(symbol - 256, 7);
+    else bits.putCode(0xc0 + symbol - 280, 8);
+}
+
+inline void putMatch(BitWriter& bits, int length, int distance) {
+    static const int lengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                       35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static const int lengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    static const int distanceBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                         257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                         8193, 12289, 16385, 24577};
+    int code = 28;
+    while (lengthBase[code] > length) code--;
+    putLiteral(bits, 257 + code);
+    bits.put(length - lengthBase[code], lengthExtra[code]);
+    int distanceCode = 29;
+    while (distanceBase[distanceCode] > distance) distanceCode--;
+    bits.putCode(distanceCode, 5);
+    bits.put(distance - distanceBase[distanceCode], distanceCode < 4 ? 0 : distanceCode / 2 - 1);
+}
+
+// Compresses data as one fixed-Huffman block with greedy LZ77 matching
+// inside the strip only, so strips compress independently. A non-final
+// strip ends with an empty stored block (a zlib sync flush), which leaves
+// the stream byte aligned so strips can simply be concatenated.
+inline void deflateStrip(const std::uint8_t* data, std::size_t size, bool final, std::vector<std::uint8_t>& out) {
+    constexpr int HASH_BITS = 15;
+    constexpr std::size_t WINDOW = 32768;
+    thread_local std::vector<std::int64_t> head;
+    head.assign(std::size_t(1) << HASH_BITS, -1);
+    auto hash = [&](std::size_t i) {
+        std::uint32_t v = data[i] | data[i + 1] << 8 | data[i + 2] << 16;
+        return (v * 2654435761u) >> (32 - HASH_BITS);
+    };
+    
+    BitWriter bits(out);
+    bits.put(final ? 1 : 0, 1);
+    bits.put(1, 2);     // fixed Huffman
+    std::size_t i = 0;
+    while (i < size) {
+        if (i + 3 <= size) {
+            std::uint32_t h = hash(i);
+            std::int64_t candidate = head[h];
+            head[h] = static_cast<std::int64_t>(i);
+            if (candidate >= 0 && i - candidate <= WINDOW) {
+                std::size_t limit = std::min<std::size_t>(258, size - i);
+                std::size_t length = 0;
+                while (length < limit && data[candidate + length] == data[i + length]) length++;
+                if (length >= 3) {
+                    putMatch(bits, static_cast<int>(length), static_cast<int>(i - candidate));
+                    // Index a few positions inside the match to keep finding runs
+                    for (std::size_t k = 1; k < length && k < 4 && i + k + 3 <= size; k++) {
+                        head[hash(i + k)] = static_cast<std::int64_t>(i + k);
+                    }
+                    i += length;
+                    continue;
+                }
+            }
+        }
+        putLiteral(bits, data[i]);
+        i++;
+    }
+    putLiteral(bits, 256);
+    if (final) {
+        bits.alignToByte();
+    } else {
+        bits.put(0, 3);     // empty stored block
+        bits.alignToByte();
+        out.insert(out.end(), {0x00, 0x00, 0xff, 0xff});
+    }
+}
+
+// PNG scanlines for rows [begin, end), each with the cheapest of the None,
+// Sub and Up filters by sum of absolute residuals
+inline void filterRows(const std::uint8_t* rgba, int width, int begin, int end, std::vector<std::uint8_t>& out) {
+    std::size_t stride = static_cast<std::size_t>(width) * 4;
+    out.resize((stride + 1) * (end - begin));
+    std::vector<std::uint8_t> candidate(stride);
+    for (int y = begin; y < end; y++) {
+        const std::uint8_t* row = rgba + y * stride;
+        const std::uint8_t* above = y > 0 ? row - stride : nullptr;
+        std::uint8_t* target = &out[(stride + 1) * (y - begin)];
+        auto cost = [&](const std::uint8_t* line) {
+            std::uint32_t sum = 0;
+            for (std::size_t i = 0; i < stride; i++) sum += std::abs(static_cast<std::int8_t>(line[i]));
+            return sum;
+        };
+        // Sub
+        for (std::size_t i = 0; i < stride; i++) candidate[i] = static_cast<std::uint8_t>(row[i] - (i >= 4 ? row[i - 4] : 0));
+        std::uint32_t best = cost(row);
+        std::uint8_t filter = 0;
+        std::memcpy(target + 1, row, stride);
+        std::uint32_t sub = cost(candidate.data());
+        if (sub < best) {
+            best = sub;
+            filter = 1;
+            std::memcpy(target + 1, candidate.data(), stride);
+        }
+        if (above) {
+            for (std::size_t i = 0; i < stride; i++) candidate[i] = static_cast<std::uint8_t>(row[i] - above[i]);
+            if (cost(candidate.data()) < best) {
+                filter = 2;
+                std::memcpy(target + 1, candidate.data(), stride);
+            }
+        }
+        target[0] = filter;
+    }
+}
+
+inline void putChunk(std::vector<std::uint8_t>& out, const char* type, const std::uint8_t* data, std::size_t size) {
+    for (int shift = 24; shift >= 0; shift -= 8) out.push_back(static_cast<std::uint8_t>(size >> shift));
+    std::size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data, data + size);
+    std::uint32_t crc = crc32(&out[start], out.size() - start);
+    for (int shift = 24; shift >= 0; shift -= 8) out.push_back(static_cast<std::uint8_t>(crc >> shift));
+}
+
+}  // namespace png_detail
+
+// Encodes RGBA frames to numbered QOI or PNG files on its own threads and
+// hands them to an ExportWriter in submission order. Many frames are in
+// flight at once; a PNG frame is further split into strips of STRIP_ROWS
+// rows that are filtered and deflated independently, then stitched with
+// the combined Adler-32. submit() copies the frame and returns, waiting only
+// when the in-flight limit is reached.
+class FrameEncoder {
+public:
+    static constexpr int STRIP_ROWS = 64;
+    
+private:
+    struct Frame {
+        std::uint64_t index;
+        int width, height;
+        std::vector<std::uint8_t> rgba;     // released once encoded
+        std::size_t rawSize;
+        std::vector<std::vector<std::uint8_t>> strips;
+        std::vector<std::uint32_t> adlers;
+        std::vector<std::size_t> filteredSizes;
+        unsigned remaining;
+        std::vector<std::uint8_t> encoded;
+        bool done = false;
+    };
+    
+    struct Task {
+        Frame* frame;
+        int strip;
+    };
+    
+    ExportWriter& writer;
+    std::string prefix;
+    ImageFormat format;
+    unsigned maxInFlight;
+    std::deque<std::unique_ptr<Frame>> frames;      // submission order
+    std::deque<Task> tasks;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable taskReady;
+    std::condition_variable frameCommitted;
+    bool stopping = false;
+    bool committing = false;    // a thread is writing frames without the lock
+    std::uint64_t nextIndex = 0;
+    std::uint64_t framesWritten = 0;
+    std::uint64_t encodedBytes = 0;
+    std::uint64_t rawBytes = 0;
+    std::chrono::steady_clock::time_point firstSubmit, lastCommit;
+    
+    int stripCount(const Frame& frame) const {
+        return format == ImageFormat::Png ? (frame.height + STRIP_ROWS - 1) / STRIP_ROWS : 1;
+    }
+    
+    void encodeStrip(Frame& frame, int strip) {
+        if (format == ImageFormat::Qoi) {
+            encodeQoi(frame.rgba.data(), frame.width, frame.height, frame.encoded);
+            return;
+        }
+        thread_local std::vector<std::uint8_t> filtered;
+        int begin = strip * STRIP_ROWS;
+        int end = std::min(frame.height, begin + STRIP_ROWS);
+        png_detail::filterRows(frame.rgba.data(), frame.width, begin, end, filtered);
+        frame.adlers[strip] = png_detail::adler32(filtered.data(), filtered.size());
+        frame.filteredSizes[strip] = filtered.size();
+        png_detail::deflateStrip(filtered.data(), filtered.size(), strip + 1 == stripCount(frame), frame.strips[strip]);
+    }
+    
+    void assemblePng(Frame& frame) {
+        std::vector<std::uint8_t>& out = frame.encoded;
+        out.insert(out.end(), {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'});
+        std::uint8_t header[13] = {};
+        for (int i = 0; i < 4; i++) {
+            header[i] = static_cast<std::uint8_t>(frame.width >> (24 - 8 * i));
+            header[4 + i] = static_cast<std::uint8_t>(frame.height >> (24 - 8 * i));
+        }
+        header[8] = 8;      // bits per channel
+        header[9] = 6;      // RGBA
+        png_detail::putChunk(out, "IHDR", header, sizeof(header));
+        
+        std::vector<std::uint8_t> zlib = {0x78, 0x01};
+        std::uint32_t adler = 1;
+        for (std::size_t s = 0; s < frame.strips.size(); s++) {
+            zlib.insert(zlib.end(), frame.strips[s].begin(), frame.strips[s].end());
+            adler = s == 0 ? frame.adlers[0] : png_detail::adler32Combine(adler, frame.adlers[s], frame.filteredSizes[s]);
+        }
+        for (int shift = 24; shift >= 0; shift -= 8) zlib.push_back(static_cast<std::uint8_t>(adler >> shift));
+        png_detail::putChunk(out, "IDAT", zlib.data(), zlib.size());
+        png_detail::putChunk(out, "IEND", nullptr, 0);
+    }
+    
+    std::string pathFor(std::uint64_t index) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%06llu.%s", static_cast<unsigned long long>(index),
+                      format == ImageFormat::Png ? "png" : "qoi");
+        return prefix + name;
+    }
+    
+    // Writes every finished frame at the head of the queue. Called with the
+    // lock held, but the writes run without it, since ExportWriter::append
+    // blocks while all its buffers are in flight. Only one thread commits at
+    // a time, which keeps files in submission order; frames finished
+    // meanwhile are picked up by the committer's next round.
+    void commitReady(std::unique_lock<std::mutex>& lock) {
+        if (committing) return;
+        committing = true;
+        std::vector<Frame*> ready;
+        for (;;) {
+            ready.clear();
+            for (std::size_t i = 0; i < frames.size() && frames[i]->done; i++) ready.push_back(frames[i].get());
+            if (ready.empty()) break;
+            lock.unlock();
+            for (Frame* frame : ready) {
+                int file = writer.open(pathFor(frame->index));
+                if (file >= 0) {
+                    writer.append(file, frame->encoded.data(), frame->encoded.size());
+                    writer.close(file);
+                }
+            }
+            lock.lock();
+            // Written frames stay queued until now, so they count towards
+            // the in-flight limit and flush() waits for them
+            for (Frame* frame : ready) {
+                encodedBytes += frame->encoded.size();
+                rawBytes += frame->rawSize;
+                framesWritten++;
+                frames.pop_front();
+            }
+            lastCommit = std::chrono::steady_clock::now();
+            frameCommitted.notify_all();
+        }
+        committing = false;
+    }
+    
+    void workerLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            taskReady.wait(lock, [&]() { return stopping || !tasks.empty(); });
+            if (tasks.empty()) return;
+            Task task = tasks.front();
+            tasks.pop_front();
+            lock.unlock();
+            encodeStrip(*task.frame, task.strip);
+            lock.lock();
+            if (--task.frame->remaining > 0) continue;
+            // Last strip of the frame: stitch it outside the lock
+            lock.unlock();
+            if (format == ImageFormat::Png) assemblePng(*task.frame);
+            // The raw pixels are no longer needed while the frame waits its turn
+            std::vector<std::uint8_t>().swap(task.frame->rgba);
+            lock.lock();
+            task.frame->done = true;
+            commitReady(lock);
+        }
+    }
+    
+public:
+    FrameEncoder(ExportWriter& writer, std::string prefix, ImageFormat format,
+                 unsigned threadCount = std::max(1u, std::thread::hardware_concurrency()))
+        : writer(writer), prefix(std::move(prefix)), format(format), maxInFlight(2 * std::max(1u, threadCount)) {
+        for (unsigned i = 0; i < std::max(1u, threadCount); i++) {
+            threads.emplace_back([this]() { workerLoop(); });
+        }
+    }
+    
+    ~FrameEncoder() {
+        flush();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        taskReady.notify_all();
+        for (auto& thread : threads) thread.join();
+    }
+    
+    FrameEncoder(const FrameEncoder&) = delete;
+    FrameEncoder& operator=(const FrameEncoder&) = delete;
+    
+    void submit(const std::uint8_t* rgba, int width, int height) {
+        auto frame = std::make_unique<Frame>();
+        frame->width = width;
+        frame->height = height;
+        frame->rawSize = static_cast<std::size_t>(width) * height * 4;
+        frame->rgba.assign(rgba, rgba + frame->rawSize);
+        int strips = stripCount(*frame);
+        frame->strips.resize(strips);
+        frame->adlers.resize(strips);
+        frame->filteredSizes.resize(strips);
+        frame->remaining = static_cast<unsigned>(strips);
+        
+        std::unique_lock<std::mutex> lock(mutex);
+        frameCommitted.wait(lock, [&]() { return frames.size() < maxInFlight; });
+        if (nextIndex == 0) firstSubmit = std::chrono::steady_clock::now();
+        frame->index = nextIndex++;
+        for (int s = 0; s < strips; s++) tasks.push_back({frame.get(), s});
+        frames.push_back(std::move(frame));
+        lock.unlock();
+        taskReady.notify_all();
+    }
+    
+    // Waits until every submitted frame has been handed to the writer
+    void flush() {
+        std::unique_lock<std::mutex> lock(mutex);
+        frameCommitted.wait(lock, [&]() { return frames.empty(); });
+    }
+    
+    std::uint64_t getFramesWritten() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return framesWritten;
+    }
+    
+    // Frames per second from the first submission to the latest commit
+    double framesPerSecond() {
+        std::lock_guard<std::mutex> lock(mutex);
+        double seconds = std::chrono::duration<double>(lastCommit - firstSubmit).count();
+        return framesWritten && seconds > 0 ? framesWritten / seconds : 0.0;
+    }
+    
+    double compressionRatio() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return encodedBytes ? static_cast<double>(rawBytes) / encodedBytes : 0.0;
+    }
+};
+
+// Renders a lensed background sequence with the hole sweeping across the
+// screen and encodes it without opening a window
+void renderLensedSequence(const std::string& prefix, ImageFormat format, int frames) {
+    WorkerPool pool;
+    DeflectionCache cache(WINDOW_WIDTH, WINDOW_HEIGHT);
+    std::vector<sf::Uint8> pixels;
+    ExportWriter writer;
+    double fps;
+    {
+        FrameEncoder encoder(writer, prefix, format);
+        for (int f = 0; f < frames; f++) {
+            float x = WINDOW_WIDTH * (0.25f + 0.5f * f / std::max(1, frames - 1));
+            BlackHole hole(Vector2f(x, WINDOW_HEIGHT / 2.0f), 30.0f);
+            cache.update(pool, hole);
+            renderLensedBackground(pool, cache, WINDOW_WIDTH, WINDOW_HEIGHT, pixels);
+            encoder.submit(pixels.data(), WINDOW_WIDTH, WINDOW_HEIGHT);
+        }
+        encoder.flush();
+        fps = encoder.framesPerSecond();
+    }
+    writer.flush();
+    std::cout << "Rendered " << frames << " frames to " << prefix << "*, " << fps << " frames/s including encoding via "
+              << writer.backendName() << "\n";
+}
+
+// ---------------------------------------------------------------------------
+// Frame pacing
+// ---------------------------------------------------------------------------
+
+// Fixed-size window of recent samples with percentile queries
+class SampleWindow {
+    std::array<double, 256> samples{};
+    std::size_t next = 0;
+    std::size_t count = 0;
+    
+public:
+    void add(double value) {
+        samples[next] = value;
+        next = (next + 1) % samples.size();
+        count = std::min(count + 1, samples.size());
+    }
+    
+    // p in [0, 1]; 0 when empty
+    double percentile(double p) const {
+        if (count == 0) return 0.0;
+        std::array<double, 256> sorted = samples;
+        std::size_t rank = std::min(count - 1, static_cast<std::size_t>(p * count));
+        std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.begin() + count);
+        return sorted[rank];
+    }
+    
+    std::size_t size() const { return count; }
+};
+
+// Holds frames to a fixed cadence. It sleeps until shortly before the
+// deadline and spins the rest of the way. The spin margin tracks how far the
+// OS actually oversleeps, so coarse timers cost CPU instead of jitter.
+class FramePacer {
+    using Clock = std::chrono::steady_clock;
+    
+    Clock::duration interval;
+    Clock::time_point deadline;
+    Clock::time_point lastFrame;
+    std::chrono::microseconds spinMargin{2000};
+    SampleWindow jitter;                // |actual interval - target|, ms
+    
+public:
+    explicit FramePacer(unsigned targetFps = 60) : deadline(Clock::now()), lastFrame(deadline) {
+        setTarget(targetFps);
+    }
+    
+    // 0 disables pacing
+    void setTarget(unsigned fps) {
+        interval = fps ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / fps))
+                       : Clock::duration::zero();
+        deadline = Clock::now();
+    }
+    
+    // Blocks until the next frame is due
+    void wait() {
+        if (interval != Clock::duration::zero()) {
+            deadline += interval;
+            Clock::time_point now = Clock::now();
+            if (now > deadline) {
+                // Missed the slot: start a new cadence instead of bursting to catch up
+                deadline = now;
+            } else {
+                Clock::time_point wake = deadline - spinMargin;
+                if (now < wake) {
+                    sf::sleep(sf::microseconds(std::chrono::duration_cast<std::chrono::microseconds>(wake - now).count()));
+                    auto overshoot = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - wake);
+                    // Grow at once when the OS oversleeps, shrink slowly otherwise
+                    if (overshoot + std::chrono::microseconds(250) > spinMargin) {
+                        spinMargin = overshoot + std::chrono::microseconds(500);
+                    } else {
+                        spinMargin -= (spinMargin - overshoot) / 32;
+                    }
+                    spinMargin = std::min(spinMargin, std::chrono::duration_cast<std::chrono::microseconds>(interval));
+                }
+                while (Clock::now() < deadline) std::this_thread::yield();
+            }
         }
-        
-        // Draw current position as a small circle
-        if (!absorbed && currentPosition.x >= 0 && currentPosition.x <= WINDOW_WIDTH) {
-            sf::CircleShape photon(3);
-            photon.setFillColor(color);
-            photon.setOrigin(3, 3);
-            photon.setPosition(currentPosition.x, currentPosition.y);
-            window.draw(photon);
+        Clock::time_point now = Clock::now();
+        if (interval != Clock::duration::zero()) {
+            jitter.add(std::abs(std::chrono::duration<double, std::milli>(now - lastFrame - interval).count()));
         }
+        lastFrame = now;
     }
     
-    bool isOffScreen() const {
-        return (currentPosition.x > WINDOW_WIDTH + 100 || 
-                currentPosition.x < -100 ||
-                currentPosition.y > WINDOW_HEIGHT + 100 || 
-                currentPosition.y < -100) && !absorbed;
+    const SampleWindow& getJitter() const { return jitter; }
+    double getSpinMarginMilliseconds() const { return spinMargin.count() / 1000.0; }
+};
+
+// Input-to-present latency. Input is stamped when it is polled (SFML events
+// carry no OS timestamp), and every stamp pending at a present becomes one
+// sample, so commands queued for the simulation are measured end to end.
+class LatencyTracker {
+    using Clock = std::chrono::steady_clock;
+    
+    std::vector<Clock::time_point> pending;
+    SampleWindow latency;               // ms
+    
+public:
+    void input() { pending.push_back(Clock::now()); }
+    
+    // Call right after the frame is handed to the display
+    void presented() {
+        Clock::time_point now = Clock::now();
+        for (Clock::time_point stamp : pending) {
+            double seconds = std::chrono::duration<double>(now - stamp).count();
+            latency.add(seconds * 1000.0);
+            if (metrics().enabled) metrics().inputLatencySeconds.observe(seconds);
+        }
+        pending.clear();
     }
     
-    bool isAbsorbed() const { return absorbed; }
+    const SampleWindow& getLatency() const { return latency; }
+};
+
+// ---------------------------------------------------------------------------
+// Simulation commands
+// ---------------------------------------------------------------------------
+
+// Everything input may ask of the simulation. Producers only enqueue; the
+// simulation applies commands at the start of its next step, so none of its
+// state is touched from outside the step.
+enum class CommandType : std::uint8_t {
+    SpawnRay,           // position, velocity
+    SpawnWavefront,
+    Reset,
+    MoveHole,           // position
+    ChangeMass,         // value is the delta
+    ChangeSpin,         // value is the delta
+    ToggleKerrEngine,
+    TogglePathStorage,
+    ExportRays,
+    ExportFlux
+};
+
+struct SimulationCommand {
+    CommandType type;
+    Vector2f position = {};
+    Vector2f velocity = {};
+    float value = 0.0f;
+};
+
+using CommandQueue = MpscQueue<SimulationCommand, 1024>;
+
+// ---------------------------------------------------------------------------
+// Views
+// ---------------------------------------------------------------------------
+
+enum class ViewMode {
+    Composite,  // background, overlays and trails chosen by the H/D/L/C toggles
+    Trails,
+    Lensed,
+    Flux,
+    Disk
+};
+
+// One viewport onto the shared simulation: where it sits in the window, what
+// it shows and its own camera (zoom and pan in world pixels)
+struct SimulationView {
+    ViewMode mode;
+    sf::View camera;
+    
+    SimulationView(ViewMode mode, const sf::FloatRect& viewport) : mode(mode) {
+        camera.reset(sf::FloatRect(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT));
+        camera.setViewport(viewport);
+    }
+    
+    const char* label() const {
+        switch (mode) {
+            case ViewMode::Trails: return "Trails";
+            case ViewMode::Lensed: return "Lensed";
+            case ViewMode::Flux: return "Flux";
+            case ViewMode::Disk: return "Disk";
+            default: return "";
+        }
+    }
+};
+
+// Read-only state every view draws from. Layers are produced at most once
+// per frame, and only when some view shows them, so adding views never adds
+// physics or shading work.
+struct FrameSnapshot {
+    const BlackHole& hole;
+    const RayStore& rays;
+    const CausticTracker* caustics;     // null when hidden
+    const sf::Texture* lensed;          // null when no view needs the layer
+    const sf::Texture* flux;
+    float fluxCellSize;
+    const sf::Texture* disk;
+    const sf::Texture* trails;          // HDR trail image; null when trails are drawn as lines
 };
 
 class BlackHoleSimulation {
 private:
     sf::RenderWindow window;
     BlackHole blackHole;
-    std::vector<LightRay> lightRays;
+    RayStore lightRays;
+    WorkerPool workerPool;
+    FluxAccumulator flux;
+    sf::Texture fluxTexture;
+    std::vector<sf::Uint8> fluxPixels;
+    bool showFlux;
+    KerrPhotonEngine kerrEngine;
+    bool useKerrEngine;
+    DiskRayMarcher diskMarcher;
+    ProgressiveRenderer diskRenderer;
+    sf::Texture diskTexture;
+    bool showDisk;
+    DeflectionCache deflectionCache;
+    std::vector<sf::Uint8> lensedPixels;
+    LensedRenderStats lensedStats;
+    sf::Texture lensedTexture;
+    bool showLensed;
+    bool draggingHole;
+    TrailAccumulator hdrTrails;
+    std::vector<sf::Uint8> hdrPixels;
+    sf::Texture hdrTexture;
+    bool showHdrTrails;
+    WavefrontEngine wavefronts;
+    int wavefrontCount;
+    CausticTracker caustics;
+    bool showCaustics;
+    MortonSorter raySorter;
+    std::vector<SimulationView> views;
+    bool multiView;
+    CommandQueue commands;
+    std::atomic<std::size_t> droppedCommands{0};
+    FramePacer pacer;
+    LatencyTracker latency;
+    ExportWriter exporter;
+    std::unique_ptr<RayStateDump> rayDump;
+    std::unique_ptr<FrameEncoder> recorder;
+    sf::Texture captureTexture;
     sf::Clock clock;
     sf::Font font;
     sf::Text infoText;
@@ -174,12 +5196,26 @@ private:
     int rayCount;
     
 public:
-    BlackHoleSimulation() 
+    explicit BlackHoleSimulation(unsigned targetFps = 60)
         : window(sf::VideoMode(WINDOW_WIDTH, WINDOW_HEIGHT), "2D Black Hole - Gravitational Lensing"),
           blackHole(Vector2f(WINDOW_WIDTH / 2, WINDOW_HEIGHT / 2), 50.0f),
-          raySpawnTimer(0), rayCount(0) {
+          flux(WINDOW_WIDTH, WINDOW_HEIGHT, FLUX_CELL_SIZE, workerPool.size()),
+          showFlux(false), useKerrEngine(false),
+          diskRenderer(diskMarcher, WINDOW_WIDTH, WINDOW_HEIGHT), showDisk(false),
+          deflectionCache(WINDOW_WIDTH, WINDOW_HEIGHT), showLensed(false), draggingHole(false),
+          hdrTrails(WINDOW_WIDTH, WINDOW_HEIGHT), showHdrTrails(false), wavefrontCount(0), showCaustics(true),
+          multiView(false), pacer(targetFps), raySpawnTimer(0), rayCount(0) {
         
-        window.setFramerateLimit(60);
+        memoryPolicy().firstTouchPool = &workerPool;
+        if (memoryPolicy().pinWorkers && !workerPool.pinToNodes(numaNodeCpus())) {
+            std::cout << "Could not pin workers to NUMA nodes\n";
+        }
+        fluxTexture.create(flux.getWidth(), flux.getHeight());
+        fluxTexture.setSmooth(true);
+        diskTexture.create(WINDOW_WIDTH, WINDOW_HEIGHT);
+        lensedTexture.create(WINDOW_WIDTH, WINDOW_HEIGHT);
+        hdrTexture.create(WINDOW_WIDTH, WINDOW_HEIGHT);
+        setLayout(false);
         
         // Setup info text
         if (!font.loadFromFile("C:/Windows/Fonts/arial.ttf")) {
@@ -193,7 +5229,11 @@ public:
         }
     }
     
-    void spawnLightRay() {
+    ~BlackHoleSimulation() {
+        memoryPolicy().firstTouchPool = nullptr;
+    }
+    
+    RayHandle spawnLightRay() {
         // Spawn rays from the left side with varying heights
         float y = 50 + (rayCount % 15) * 50; // Spread rays vertically
         Vector2f startPos(-50, y);
@@ -206,13 +5246,159 @@ public:
         };
         sf::Color rayColor = colors[rayCount % 7];
         
-        lightRays.emplace_back(startPos, velocity, rayColor);
+        RayHandle handle = lightRays.emplace(startPos, velocity, rayColor);
+        lightRays.get(handle)->setEmitter(blackHole);
         rayCount++;
+        return handle;
+    }
+    
+    // One composite view, or a 2x2 grid of trails, lensed, flux and disk
+    void setLayout(bool quad) {
+        multiView = quad;
+        views.clear();
+        if (!quad) {
+            views.emplace_back(ViewMode::Composite, sf::FloatRect(0, 0, 1, 1));
+            return;
+        }
+        views.emplace_back(ViewMode::Trails, sf::FloatRect(0, 0, 0.5f, 0.5f));
+        views.emplace_back(ViewMode::Lensed, sf::FloatRect(0.5f, 0, 0.5f, 0.5f));
+        views.emplace_back(ViewMode::Flux, sf::FloatRect(0, 0.5f, 0.5f, 0.5f));
+        views.emplace_back(ViewMode::Disk, sf::FloatRect(0.5f, 0.5f, 0.5f, 0.5f));
+    }
+    
+    // View whose viewport contains the window pixel
+    SimulationView* viewAt(int x, int y) {
+        float u = static_cast<float>(x) / WINDOW_WIDTH;
+        float v = static_cast<float>(y) / WINDOW_HEIGHT;
+        for (SimulationView& view : views) {
+            const sf::FloatRect& area = view.camera.getViewport();
+            if (u >= area.left && u < area.left + area.width && v >= area.top && v < area.top + area.height) return &view;
+        }
+        return nullptr;
+    }
+    
+    // World position under a window pixel, through that viewport's camera
+    Vector2f worldAt(int x, int y) {
+        SimulationView* view = viewAt(x, y);
+        sf::Vector2f world = view ? window.mapPixelToCoords(sf::Vector2i(x, y), view->camera)
+                                  : sf::Vector2f(static_cast<float>(x), static_cast<float>(y));
+        return Vector2f(world.x, world.y);
+    }
+    
+    // Enqueues a command from any thread; it takes effect at the next step
+    bool post(const SimulationCommand& command) {
+        if (commands.tryPush(command)) return true;
+        droppedCommands.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    
+    // Relaxed stores only; the metrics server reads them from its own thread
+    void publishMetrics(const StepResult& step, float deltaTime, double stepSeconds) {
+        SimulationMetrics& m = metrics();
+        m.frameSeconds.observe(deltaTime);
+        m.stepSeconds.observe(stepSeconds);
+        SimulationMetrics::add(m.raySteps, step.stepped);
+        SimulationMetrics::add(m.raysEscaped, step.escaped);
+        if (deltaTime > 0) {
+            double rate = step.stepped / deltaTime;
+            double smoothed = m.raysPerSecond.load(std::memory_order_relaxed);
+            m.raysPerSecond.store(smoothed + 0.1 * (rate - smoothed), std::memory_order_relaxed);
+        }
+        m.activeRays.store(lightRays.activeCount(), std::memory_order_relaxed);
+        m.absorbedRays.store(lightRays.absorbedCount(), std::memory_order_relaxed);
+        std::uint64_t points = 0;
+        std::uint64_t bytes = 0;
+        for (const LightRay& ray : lightRays) {
+            points += ray.getPath().size();
+            bytes += ray.getPath().bytes();
+        }
+        m.pathPoints.store(points, std::memory_order_relaxed);
+        m.pathBytes.store(bytes, std::memory_order_relaxed);
+    }
+    
+    // Applies everything posted since the last step
+    void drainCommands() {
+        SimulationCommand command;
+        while (commands.tryPop(command)) {
+            switch (command.type) {
+                case CommandType::SpawnRay:
+                    lightRays.get(lightRays.emplace(command.position, command.velocity, sf::Color::White))->setEmitter(blackHole);
+                    rayCount++;
+                    break;
+                case CommandType::SpawnWavefront:
+                    spawnWavefront();
+                    break;
+                case CommandType::Reset:
+                    lightRays.clear();
+                    wavefronts.clear();
+                    caustics.clear();
+                    rayCount = 0;
+                    flux.clear();
+                    break;
+                case CommandType::MoveHole:
+                    blackHole.setPosition(command.position);
+                    break;
+                case CommandType::ChangeMass:
+                    blackHole.setMass(blackHole.getMass() + command.value);
+                    break;
+                case CommandType::ChangeSpin:
+                    blackHole.setSpin(blackHole.getSpin() + command.value);
+                    break;
+                case CommandType::ToggleKerrEngine:
+                    useKerrEngine = !useKerrEngine;
+                    break;
+                case CommandType::TogglePathStorage:
+                    pathStorage() = pathStorage() == PathStorage::Float ? PathStorage::Quantized : PathStorage::Float;
+                    break;
+                case CommandType::ExportRays: {
+                    // Serialized here, written by the export I/O thread
+                    std::ostringstream rays;
+                    writeRayStates(lightRays, rays);
+                    if (exporter.writeFile("rays.csv", rays.str())) {
+                        std::cout << "Exporting " << lightRays.size() << " rays to rays.csv\n";
+                    } else {
+                        std::cout << "Failed to write rays.csv\n";
+                    }
+                    std::ostringstream curves;
+                    caustics.writeCSV(curves);
+                    if (exporter.writeFile("caustics.csv", curves.str())) {
+                        std::cout << "Exporting " << caustics.getCurves().size() << " caustic curves to caustics.csv\n";
+                    }
+                    break;
+                }
+                case CommandType::ExportFlux: {
+                    flux.resolve(workerPool);
+                    std::ostringstream image;
+                    flux.writePFM(image);
+                    if (exporter.writeFile("flux.pfm", image.str())) {
+                        std::cout << "Exporting flux map to flux.pfm\n";
+                    } else {
+                        std::cout << "Failed to write flux.pfm\n";
+                    }
+                    break;
+                }
+            }
+        }
+    }
+    
+    // Stable lookup for tools that track individual rays; null once removed
+    const LightRay* getRay(RayHandle handle) const { return lightRays.get(handle); }
+    
+    // Emits a vertical front of sparse rays; the wavefront engine adds rays
+    // wherever lensing pulls neighbours apart
+    void spawnWavefront() {
+        sf::Color colors[] = {sf::Color::Cyan, sf::Color::Yellow, sf::Color::Magenta, sf::Color::Green};
+        wavefronts.emit(lightRays, Vector2f(-50, 50), Vector2f(-50, WINDOW_HEIGHT - 50),
+                        Vector2f(LIGHT_SPEED, 0), 16, colors[wavefrontCount % 4]);
+        wavefrontCount++;
     }
     
     void update() {
         float deltaTime = clock.restart().asSeconds();
         
+        // Step boundary: apply input posted since the last frame
+        drainCommands();
+        
         // Spawn new light rays periodically
         raySpawnTimer += deltaTime;
         if (raySpawnTimer > 0.3f) { // Spawn every 0.3 seconds
@@ -220,41 +5406,156 @@ public:
             raySpawnTimer = 0;
         }
         
-        // Update all light rays
-        for (auto& ray : lightRays) {
-            ray.update(blackHole, deltaTime);
+        // Update the active rays and retire absorbed and escaped ones
+        auto stepStart = std::chrono::steady_clock::now();
+        StepResult step = stepRays(workerPool, lightRays, blackHole, useKerrEngine ? &kerrEngine : nullptr, deltaTime, &flux);
+        if (metrics().enabled) {
+            publishMetrics(step, deltaTime, std::chrono::duration<double>(std::chrono::steady_clock::now() - stepStart).count());
         }
+        if (rayDump) rayDump->write(lightRays);
+        exporter.submit();
+        
+        // Split and merge wavefront rays where neighbours diverge or converge
+        caustics.setLens(blackHole.getPosition(), Vector2f(1, 0));
+        wavefronts.refine(lightRays, &caustics);
         
-        // Remove rays that are off-screen
-        lightRays.erase(
-            std::remove_if(lightRays.begin(), lightRays.end(),
-                [](const LightRay& ray) { return ray.isOffScreen(); }),
-            lightRays.end()
-        );
+        // Keep the store in Z-order when the cost model says it pays off
+        raySorter.update(lightRays);
         
         // Update info text
         if (font.getInfo().family != "") {
-            infoText.setString("Light Rays: " + std::to_string(lightRays.size()) + 
+            infoText.setString("Light Rays: " + std::to_string(lightRays.activeCount()) + " active, " +
+                             std::to_string(lightRays.absorbedCount()) + " absorbed" +
                              "\nTotal Spawned: " + std::to_string(rayCount) +
                              "\nPress ESC to exit" +
-                             "\nPress R to reset");
+                             "\nPress R to reset" +
+                             "\nPress H to toggle flux heatmap" +
+                             "\nPress F to export flux.pfm" +
+                             "\nPress K for Kerr engine (" + (useKerrEngine ? "on" : "off") + ")" +
+                             "\nPress [ ] to change spin (" + std::to_string(blackHole.getSpin()).substr(0, 5) + ")" +
+                             "\nPress D for accretion disk view" +
+                             "\nPress X to export rays.csv" +
+                             "\nPress W to emit a wavefront (" + std::to_string(wavefronts.getFrontCount()) + " fronts)" +
+                             "\nPress C to toggle caustics (" + std::to_string(caustics.getCurves().size()) + " curves, " +
+                             std::to_string(caustics.getCusps().size()) + " cusps)" +
+                             "\nPress - = to change mass (" + std::to_string(static_cast<int>(blackHole.getMass())) + ")" +
+                             "\nPress L for lensed background, drag the hole with the mouse" +
+                             "\nPress A for additive HDR trails (" + (showHdrTrails ? formatMilliseconds(hdrTrails.getLastAccumulateMilliseconds() +
+                                 hdrTrails.getLastToneMapMilliseconds()) + " ms)" : "off)") +
+                             "\nRight-click to launch a ray, scroll to zoom" +
+                             "\nPress V for " + (multiView ? "a single view" : "four views") +
+                             "\nPress Q for 16-bit trails (" + (pathStorage() == PathStorage::Quantized ? "on" : "off") + ")" +
+                             "\nFrame jitter p50/p99: " + formatMilliseconds(pacer.getJitter().percentile(0.5)) +
+                             " / " + formatMilliseconds(pacer.getJitter().percentile(0.99)) + " ms" +
+                             "\nInput latency p50/p95/p99: " + formatMilliseconds(latency.getLatency().percentile(0.5)) +
+                             " / " + formatMilliseconds(latency.getLatency().percentile(0.95)) +
+                             " / " + formatMilliseconds(latency.getLatency().percentile(0.99)) + " ms" +
+                             (exporter.getBytesWritten() ? "\nExported " + std::to_string(exporter.getBytesWritten() >> 20) +
+                                 " MB via " + exporter.backendName() + ", stalled " +
+                                 formatMilliseconds(exporter.getStallSeconds() * 1000.0) + " ms" : "") +
+                             (recorder ? "\nRecorded " + std::to_string(recorder->getFramesWritten()) + " frames at " +
+                                 std::to_string(static_cast<int>(recorder->framesPerSecond())) + " fps encoded" : "") +
+                             (droppedCommands.load() ? "\nDropped commands: " + std::to_string(droppedCommands.load()) : "") +
+                             (showLensed ? "\nDrag update: " + std::to_string(deflectionCache.getLastUpdateMilliseconds()).substr(0, 5) +
+                                 " ms, " + std::to_string(deflectionCache.getLastRecomputed()) + " px recomputed, " +
+                                 std::to_string(100 * lensedStats.supersampledPixels / (WINDOW_WIDTH * WINDOW_HEIGHT)) +
+                                 "% supersampled" +
+                                 (deflectionCache.getRebuildProgress() < 1.0f ? ", field " +
+                                     std::to_string(static_cast<int>(deflectionCache.getRebuildProgress() * 100)) + "% rebuilt" : "") : "") +
+                             (showDisk ? "\nDisk render: " + std::to_string(static_cast<int>(diskRenderer.getProgress() * 100)) + "% refined" : ""));
         }
     }
     
+    static std::string formatMilliseconds(double ms) {
+        return std::to_string(ms).substr(0, 5);
+    }
+    
     void handleEvents() {
         sf::Event event;
         while (window.pollEvent(event)) {
             if (event.type == sf::Event::Closed) {
                 window.close();
             }
+            if (event.type == sf::Event::KeyPressed || event.type == sf::Event::MouseButtonPressed ||
+                event.type == sf::Event::MouseWheelScrolled) {
+                latency.input();
+            }
+            if (event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Left) {
+                Vector2f mouse = worldAt(event.mouseButton.x, event.mouseButton.y);
+                draggingHole = distanceSquared(mouse, blackHole.getPosition()) < 30.0f * 30.0f;
+            }
+            if (event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Right) {
+                // Launch a ray rightwards from the cursor
+                post({CommandType::SpawnRay, worldAt(event.mouseButton.x, event.mouseButton.y), Vector2f(LIGHT_SPEED, 0)});
+            }
+            if (event.type == sf::Event::MouseWheelScrolled) {
+                // Zoom the view under the cursor, keeping the point under it fixed
+                SimulationView* view = viewAt(event.mouseWheelScroll.x, event.mouseWheelScroll.y);
+                if (view) {
+                    Vector2f before = worldAt(event.mouseWheelScroll.x, event.mouseWheelScroll.y);
+                    view->camera.zoom(event.mouseWheelScroll.delta > 0 ? 0.8f : 1.25f);
+                    Vector2f after = worldAt(event.mouseWheelScroll.x, event.mouseWheelScroll.y);
+                    sf::Vector2f center = view->camera.getCenter();
+                    view->camera.setCenter(center.x + before.x - after.x, center.y + before.y - after.y);
+                }
+            }
+            if (event.type == sf::Event::MouseButtonReleased && event.mouseButton.button == sf::Mouse::Left) {
+                draggingHole = false;
+            }
+            if (event.type == sf::Event::MouseMoved && draggingHole) {
+                post({CommandType::MoveHole, worldAt(event.mouseMove.x, event.mouseMove.y)});
+            }
             if (event.type == sf::Event::KeyPressed) {
                 if (event.key.code == sf::Keyboard::Escape) {
                     window.close();
                 }
                 if (event.key.code == sf::Keyboard::R) {
-                    // Reset simulation
-                    lightRays.clear();
-                    rayCount = 0;
+                    post({CommandType::Reset});
+                }
+                if (event.key.code == sf::Keyboard::H) {
+                    showFlux = !showFlux;
+                }
+                if (event.key.code == sf::Keyboard::C) {
+                    showCaustics = !showCaustics;
+                }
+                if (event.key.code == sf::Keyboard::W) {
+                    post({CommandType::SpawnWavefront});
+                }
+                if (event.key.code == sf::Keyboard::X) {
+                    post({CommandType::ExportRays});
+                }
+                if (event.key.code == sf::Keyboard::D) {
+                    showDisk = !showDisk;
+                }
+                if (event.key.code == sf::Keyboard::L) {
+                    showLensed = !showLensed;
+                }
+                if (event.key.code == sf::Keyboard::A) {
+                    showHdrTrails = !showHdrTrails;
+                }
+                if (event.key.code == sf::Keyboard::V) {
+                    setLayout(!multiView);
+                }
+                if (event.key.code == sf::Keyboard::Hyphen) {
+                    post({CommandType::ChangeMass, {}, {}, -5.0f});
+                }
+                if (event.key.code == sf::Keyboard::Equal) {
+                    post({CommandType::ChangeMass, {}, {}, 5.0f});
+                }
+                if (event.key.code == sf::Keyboard::K) {
+                    post({CommandType::ToggleKerrEngine});
+                }
+                if (event.key.code == sf::Keyboard::Q) {
+                    post({CommandType::TogglePathStorage});
+                }
+                if (event.key.code == sf::Keyboard::LBracket) {
+                    post({CommandType::ChangeSpin, {}, {}, -0.1f});
+                }
+                if (event.key.code == sf::Keyboard::RBracket) {
+                    post({CommandType::ChangeSpin, {}, {}, 0.1f});
+                }
+                if (event.key.code == sf::Keyboard::F) {
+                    post({CommandType::ExportFlux});
                 }
             }
         }
@@ -263,23 +5564,150 @@ public:
     void render() {
         window.clear(sf::Color::Black);
         
-        // Draw grid for reference
-        drawGrid();
-        
-        // Draw black hole
-        blackHole.draw(window);
+        // Shared layers are produced once, however many views show them
+        bool needDisk = false, needLensed = false, needFlux = false, needTrails = false;
+        for (const SimulationView& view : views) {
+            bool composite = view.mode == ViewMode::Composite;
+            needTrails |= composite || view.mode == ViewMode::Trails;
+            needDisk |= view.mode == ViewMode::Disk || (composite && showDisk);
+            needLensed |= view.mode == ViewMode::Lensed || (composite && !showDisk && showLensed);
+            needFlux |= view.mode == ViewMode::Flux || (composite && showFlux);
+        }
+        if (needDisk) {
+            // Coarse image on the first frame, refined within a per-frame budget
+            diskRenderer.restartIfChanged(workerPool, blackHole);
+            diskRenderer.refine(workerPool, 8.0);
+            diskTexture.update(diskRenderer.getPixels().data());
+        }
+        if (needLensed) {
+            // Only the strips exposed by dragging are recomputed; a new mass
+            // rebuilds over several frames behind the previous image
+            if (deflectionCache.update(workerPool, blackHole, 8.0)) {
+                lensedStats = renderLensedBackground(workerPool, deflectionCache, WINDOW_WIDTH, WINDOW_HEIGHT, lensedPixels);
+                lensedTexture.update(lensedPixels.data());
+            }
+        }
+        if (needFlux) {
+            updateFluxTexture();
+        }
+        bool hdr = needTrails && showHdrTrails;
+        if (hdr) {
+            hdrTrails.accumulate(workerPool, lightRays);
+            hdrTrails.toneMap(workerPool, hdrPixels);
+            hdrTexture.update(hdrPixels.data());
+        }
         
-        // Draw light rays
-        for (const auto& ray : lightRays) {
-            ray.draw(window);
+        FrameSnapshot snapshot{blackHole, lightRays, showCaustics ? &caustics : nullptr,
+                               needLensed && deflectionCache.isReady() ? &lensedTexture : nullptr,
+                               needFlux ? &fluxTexture : nullptr, flux.getCellSize(),
+                               needDisk ? &diskTexture : nullptr, hdr ? &hdrTexture : nullptr};
+        for (const SimulationView& view : views) {
+            window.setView(view.camera);
+            drawView(view.mode, snapshot);
         }
+        window.setView(window.getDefaultView());
         
         // Draw info text
         if (font.getInfo().family != "") {
             window.draw(infoText);
+            for (const SimulationView& view : views) {
+                if (view.mode == ViewMode::Composite) continue;
+                sf::Text label;
+                label.setFont(font);
+                label.setCharacterSize(16);
+                label.setFillColor(sf::Color::White);
+                label.setString(view.label());
+                const sf::FloatRect& area = view.camera.getViewport();
+                label.setPosition(area.left * WINDOW_WIDTH + area.width * WINDOW_WIDTH - 80, area.top * WINDOW_HEIGHT + 8);
+                window.draw(label);
+            }
+        }
+        
+        if (recorder) {
+            // The back buffer, before display() swaps it away
+            captureTexture.update(window);
+            sf::Image frame = captureTexture.copyToImage();
+            recorder->submit(frame.getPixelsPtr(), static_cast<int>(frame.getSize().x), static_cast<int>(frame.getSize().y));
         }
         
         window.display();
+        latency.presented();
+    }
+    
+    // Draws one view through the current camera from the shared snapshot
+    void drawView(ViewMode mode, const FrameSnapshot& frame) {
+        auto drawTrails = [&]() {
+            if (frame.trails) {
+                window.draw(sf::Sprite(*frame.trails), sf::BlendAdd);
+            } else {
+                for (const auto& ray : frame.rays) {
+                    ray.draw(window);
+                }
+            }
+            if (frame.caustics) {
+                frame.caustics->draw(window);
+            }
+        };
+        
+        switch (mode) {
+            case ViewMode::Composite:
+                if (showDisk) {
+                    window.draw(sf::Sprite(*frame.disk));
+                } else if (showLensed && frame.lensed) {
+                    window.draw(sf::Sprite(*frame.lensed));
+                } else {
+                    // Draw grid for reference
+                    drawGrid();
+                }
+                if (showFlux) drawFluxSprite(frame);
+                frame.hole.draw(window);
+                drawTrails();
+                break;
+            case ViewMode::Trails:
+                drawGrid();
+                frame.hole.draw(window);
+                drawTrails();
+                break;
+            case ViewMode::Lensed:
+                // Plain grid until the first field is built
+                if (frame.lensed) {
+                    window.draw(sf::Sprite(*frame.lensed));
+                } else {
+                    drawGrid();
+                }
+                frame.hole.draw(window);
+                break;
+            case ViewMode::Flux:
+                drawFluxSprite(frame);
+                frame.hole.draw(window);
+                break;
+            case ViewMode::Disk:
+                window.draw(sf::Sprite(*frame.disk));
+                break;
+        }
+    }
+    
+    void updateFluxTexture() {
+        flux.resolve(workerPool);
+        
+        // Log-scaled black -> red -> yellow -> white ramp
+        const std::vector<float>& cells = flux.getGrid();
+        float scale = 1.0f / std::log1p(std::max(flux.maxValue(), 1.0f));
+        fluxPixels.resize(cells.size() * 4);
+        for (std::size_t i = 0; i < cells.size(); i++) {
+            float t = std::log1p(cells[i]) * scale;
+            fluxPixels[i * 4 + 0] = static_cast<sf::Uint8>(255 * std::min(1.0f, t * 3.0f));
+            fluxPixels[i * 4 + 1] = static_cast<sf::Uint8>(255 * std::clamp(t * 3.0f - 1.0f, 0.0f, 1.0f));
+            fluxPixels[i * 4 + 2] = static_cast<sf::Uint8>(255 * std::clamp(t * 3.0f - 2.0f, 0.0f, 1.0f));
+            fluxPixels[i * 4 + 3] = static_cast<sf::Uint8>(200 * std::min(1.0f, t * 4.0f));
+        }
+        fluxTexture.update(fluxPixels.data());
+    }
+    
+    void drawFluxSprite(const FrameSnapshot& frame) {
+        sf::Sprite sprite(*frame.flux);
+        sprite.setScale(frame.fluxCellSize, frame.fluxCellSize);
+        window.draw(sprite);
     }
     
     void drawGrid() {
@@ -305,8 +5733,23 @@ public:
         }
     }
     
+    // Streams the ray state of every frame to path through the export writer
+    bool startRayDump(const std::string& path) {
+        rayDump = std::make_unique<RayStateDump>(exporter, path);
+        if (!rayDump->isOpen()) rayDump.reset();
+        return rayDump != nullptr;
+    }
+    
+    // Encodes every presented frame to prefix000000.qoi/.png, ...
+    void startRecording(const std::string& prefix, ImageFormat format) {
+        captureTexture.create(WINDOW_WIDTH, WINDOW_HEIGHT);
+        recorder = std::make_unique<FrameEncoder>(exporter, prefix, format);
+    }
+    
     void run() {
         while (window.isOpen()) {
+            // Wait before polling so input that arrives meanwhile still makes this frame
+            pacer.wait();
             handleEvents();
             update();
             render();
@@ -314,9 +5757,769 @@ public:
     }
 };
 
-int main() {
+// ---------------------------------------------------------------------------
+// Benchmarks (run with --bench)
+// ---------------------------------------------------------------------------
+
+// The original ad-hoc vector, kept only as the microbenchmark baseline
+struct LegacyVector2f {
+    float x, y;
+    LegacyVector2f(float x = 0, float y = 0) : x(x), y(y) {}
+    LegacyVector2f operator+(const LegacyVector2f& o) const { return LegacyVector2f(x + o.x, y + o.y); }
+    LegacyVector2f operator-(const LegacyVector2f& o) const { return LegacyVector2f(x - o.x, y - o.y); }
+    LegacyVector2f operator*(float s) const { return LegacyVector2f(x * s, y * s); }
+    float magnitude() const { return std::sqrt(x * x + y * y); }
+    LegacyVector2f normalized() const {
+        float mag = magnitude();
+        if (mag > 0) return LegacyVector2f(x / mag, y / mag);
+        return LegacyVector2f(0, 0);
+    }
+};
+
+// Runs fn(iterations) and prints the time per iteration
+template <typename Fn>
+double benchmark(const char* name, std::size_t iterations, Fn&& fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn(iterations);
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+    std::cout << "  " << name << ": " << ns << " ns/op\n";
+    return ns;
+}
+
+// Keeps results observable so the optimizer cannot drop benchmark loops
+volatile float benchmarkSink;
+
+void benchmarkMath() {
+    std::cout << "Math layer\n";
+    const std::size_t rays = 4096;
+    const std::size_t steps = 256;
+    const LegacyVector2f legacyHole(WINDOW_WIDTH / 2.0f, WINDOW_HEIGHT / 2.0f);
+    const Vector2f hole(WINDOW_WIDTH / 2.0f, WINDOW_HEIGHT / 2.0f);
+    const float g = 500000.0f, dt = 1.0f / 60.0f, b = 100.0f;
+    
+    std::vector<LegacyVector2f> legacyPos(rays), legacyVel(rays);
+    std::vector<Vector2f> pos(rays), vel(rays);
+    auto resetRays = [&]() {
+        for (std::size_t i = 0; i < rays; i++) {
+            float y = 50.0f + (i % 15) * 50.0f;
+            legacyPos[i] = LegacyVector2f(-50.0f, y);
+            legacyVel[i] = LegacyVector2f(200.0f, 0.0f);
+            pos[i] = Vector2f(-50.0f, y);
+            vel[i] = Vector2f(200.0f, 0.0f);
+        }
+    };
+    
+    // The ray kernel as it was written against the legacy struct
+    resetRays();
+    double legacyNs = benchmark("legacy Vector2f ray step", rays * steps, [&](std::size_t) {
+        for (std::size_t s = 0; s < steps; s++) {
+            for (std::size_t i = 0; i < rays; i++) {
+                LegacyVector2f toHole = legacyHole - legacyPos[i];
+                float distance = toHole.magnitude();
+                LegacyVector2f acceleration = toHole.normalized() * (g / (distance * distance));
+                acceleration = acceleration * (1.0f + (g * 0.001f) / (distance * b + 1.0f));
+                legacyVel[i] = legacyVel[i] + acceleration * dt;
+                legacyVel[i] = legacyVel[i].normalized() * 200.0f;
+                legacyPos[i] = legacyPos[i] + legacyVel[i] * dt;
+            }
+        }
+        benchmarkSink = legacyPos[rays / 2].x;
+    });
+    
+    auto fusedStep = [&](auto modeTag) {
+        constexpr RsqrtMode mode = decltype(modeTag)::value;
+        for (std::size_t s = 0; s < steps; s++) {
+            for (std::size_t i = 0; i < rays; i++) {
+                LengthAndDirection radial = lengthAndDirection<mode>(hole - pos[i]);
+                float factor = 1.0f + (g * 0.001f) / (radial.length * b + 1.0f);
+                vel[i] += radial.direction * (g * radial.inverseLength * radial.inverseLength * factor * dt);
+                vel[i] = lengthAndDirection<mode>(vel[i]).direction * 200.0f;
+                pos[i] += vel[i] * dt;
+            }
+        }
+        benchmarkSink = pos[rays / 2].x;
+    };
+    
+    resetRays();
+    double exactNs = benchmark("fused ray step (Exact)", rays * steps, [&](std::size_t) {
+        fusedStep(std::integral_constant<RsqrtMode, RsqrtMode::Exact>());
+    });
+    resetRays();
+    benchmark("fused ray step (FastRefined)", rays * steps, [&](std::size_t) {
+        fusedStep(std::integral_constant<RsqrtMode, RsqrtMode::FastRefined>());
+    });
+    resetRays();
+    double fastNs = benchmark("fused ray step (Fast)", rays * steps, [&](std::size_t) {
+        fusedStep(std::integral_constant<RsqrtMode, RsqrtMode::Fast>());
+    });
+    std::cout << "  speedup vs legacy: " << legacyNs / exactNs << "x exact, "
+              << legacyNs / fastNs << "x fast\n";
+    
+    // Batch kernels over spans
+    std::vector<float> lengths(rays);
+    resetRays();
+    benchmark("lengthsBatch<Exact>", rays * steps, [&](std::size_t) {
+        for (std::size_t s = 0; s < steps; s++) lengthsBatch<RsqrtMode::Exact>(pos, lengths);
+        benchmarkSink = lengths[7];
+    });
+    benchmark("lengthsBatch<Fast>", rays * steps, [&](std::size_t) {
+        for (std::size_t s = 0; s < steps; s++) lengthsBatch<RsqrtMode::Fast>(pos, lengths);
+        benchmarkSink = lengths[7];
+    });
+    benchmark("distanceSquaredBatch", rays * steps, [&](std::size_t) {
+        for (std::size_t s = 0; s < steps; s++) distanceSquaredBatch(hole, pos, lengths);
+        benchmarkSink = lengths[7];
+    });
+}
+
+void benchmarkFlux() {
+    std::cout << "Flux accumulation\n";
+    const std::size_t rays = 4096;
+    const std::size_t steps = 256;
+    const float dt = 1.0f / 60.0f;
+    BlackHole hole(Vector2f(WINDOW_WIDTH / 2.0f, WINDOW_HEIGHT / 2.0f), 50.0f);
+    WorkerPool pool;
+    FluxAccumulator flux(WINDOW_WIDTH, WINDOW_HEIGHT, FLUX_CELL_SIZE, pool.size());
+    
+    auto makeRays = [&]() {
+        RayStore result;
+        for (std::size_t i = 0; i < rays; i++) {
+            result.emplace(Vector2f(-50.0f, 50.0f + (i % 15) * 50.0f), Vector2f(200.0f, 0.0f), sf::Color::White);
+        }
+        return result;
+    };
+    
+    RayStore plain = makeRays();
+    double baseNs = benchmark("ray step without flux", rays * steps, [&](std::size_t) {
+        for (std::size_t s = 0; s < steps; s++) {
+            Span<LightRay> active = plain.active();
+            pool.parallelFor(active.size, [&](std::size_t begin, std::size_t end, unsigned) {
+                for (std::size_t i = begin; i < end; i++) active[i].update(hole, dt);
+            });
+            plain.partition();
+        }
+    });
+    
+    RayStore tracked = makeRays();
+    double fluxNs = benchmark("ray step with flux deposit", rays * steps, [&](std::size_t) {
+        for (std::size_t s = 0; s < steps; s++) {
+            Span<LightRay> active = tracked.active();
+            pool.parallelFor(active.size, [&](std::size_t begin, std::size_t end, unsigned worker) {
+                FluxWriter writer = flux.writer(worker);
+                for (std::size_t i = begin; i < end; i++) active[i].update(hole, dt, &writer);
+            });
+            tracked.partition();
+            flux.advance(dt);
+        }
+    });
+    benchmark("resolve (tree reduction + decay)", 1, [&](std::size_t) { flux.resolve(pool); });
+    std::cout << "  flux overhead: " << 100.0 * (fluxNs - baseNs) / baseNs << "% of the step ("
+              << pool.size() << " workers, " << flux.getWidth() << "x" << flux.getHeight() << " grid)\n";
+}
+
+void benchmarkKerr() {
+    std::cout << "Kerr engine\n";
+    const std::size_t rays = 1024;
+    const std::size_t frames = 600;
+    const float dt = 1.0f / 60.0f;
+    BlackHole hole(Vector2f(WINDOW_WIDTH / 2.0f, WINDOW_HEIGHT / 2.0f), 50.0f, 0.9f);
+    KerrPhotonEngine engine;
+    
+    auto makeRays = [&]() {
+        std::vector<LightRay> result;
+        for (std::size_t i = 0; i < rays; i++) {
+            float y = 50.0f + (WINDOW_HEIGHT - 100.0f) * i / rays;
+            result.emplace_back(Vector2f(-50.0f, y), Vector2f(LIGHT_SPEED, 0.0f), sf::Color::White);
+        }
+        return result;
+    };
+    
+    std::vector<LightRay> schwarzschild = makeRays();
+    double baseNs = benchmark("Schwarzschild-style update per ray-frame", rays * frames, [&](std::size_t) {
+        for (std::size_t f = 0; f < frames; f++) {
+            for (auto& ray : schwarzschild) ray.update(hole, dt);
+        }
+    });
+    
+    std::vector<LightRay> kerr = makeRays();
+    std::vector<KerrPhoton> photons(rays);
+    double kerrNs = benchmark("Kerr updateKerr per ray-frame (a = 0.9)", rays * frames, [&](std::size_t) {
+        for (std::size_t f = 0; f < frames; f++) {
+            for (std::size_t i = 0; i < rays; i++) kerr[i].updateKerr(photons[i], hole, engine, dt);
+        }
+    });
+    
+    // Substep count for a single ray grazing the photon sphere
+    KerrPhoton photon;
+    engine.initialize(photon, hole, Vector2f(-50.0f, hole.getPosition().y - 80.0f), Vector2f(LIGHT_SPEED, 0.0f));
+    int substeps = 0;
+    for (std::size_t f = 0; f < frames && !photon.captured; f++) {
+        substeps += engine.advance(photon, hole, LIGHT_SPEED * dt);
+    }
+    std::cout << "  Kerr cost: " << kerrNs / baseNs << "x the Schwarzschild-style update, "
+              << static_cast<double>(substeps) / frames << " RK4 substeps per frame on a grazing ray\n";
+}
+
+void benchmarkDisk() {
+    std::cout << "Accretion disk ray marcher (CPU, " << std::max(1u, std::thread::hardware_concurrency()) << " threads)\n";
+    WorkerPool pool;
+    DiskRayMarcher marcher;
+    marcher.render(pool, WINDOW_WIDTH, WINDOW_HEIGHT);
+    std::cout << "  1200x800 frame: " << marcher.getLastRenderMilliseconds() << " ms\n";
+    marcher.render(pool, 3840, 2160);
+    std::cout << "  3840x2160 frame: " << marcher.getLastRenderMilliseconds() << " ms\n";
+}
+
+void benchmarkDrag() {
+    std::cout << "Deflection reprojection cache (1200x800)\n";
+    WorkerPool pool;
+    BlackHole hole(Vector2f(WINDOW_WIDTH / 2.0f, WINDOW_HEIGHT / 2.0f), 50.0f);
+    DeflectionCache cache(WINDOW_WIDTH, WINDOW_HEIGHT);
+    cache.update(pool, hole);
+    std::cout << "  full recompute: " << cache.getLastUpdateMilliseconds() << " ms\n";
+    
+    // A diagonal drag of 60 events, 4 px per event
+    double total = 0;
+    std::size_t recomputed = 0;
+    const int events = 60;
+    for (int i = 1; i <= events; i++) {
+        hole.setPosition(Vector2f(WINDOW_WIDTH / 2.0f + 4.0f * i, WINDOW_HEIGHT / 2.0f + 2.0f * i));
+        cache.update(pool, hole);
+        total += cache.getLastUpdateMilliseconds();
+        recomputed += cache.getLastRecomputed();
+    }
+    std::cout << "  per drag event: " << total / events << " ms, "
+              << recomputed / events << " px recomputed\n";
+    
+    // A mass change rebuilt within the interactive 8 ms budget per frame
+    hole.setMass(60.0f);
+    int frames = 0;
+    double worst = 0;
+    do {
+        cache.update(pool, hole, 8.0);
+        worst = std::max(worst, cache.getLastUpdateMilliseconds());
+        frames++;
+    } while (cache.getRebuildProgress() < 1.0f);
+    std::cout << "  mass change: rebuilt over " << frames << " frames, worst frame " << worst << " ms\n";
+}
+
+void benchmarkLensedAntialiasing() {
+    std::cout << "Lensed image anti-aliasing (1200x800)\n";
+    WorkerPool pool;
+    BlackHole hole(Vector2f(WINDOW_WIDTH / 2.0f, WINDOW_HEIGHT / 2.0f), 30.0f);
+    DeflectionCache cache(WINDOW_WIDTH, WINDOW_HEIGHT);
+    cache.update(pool, hole);
+    
+    std::vector<sf::Uint8> reference;
+    renderLensedBackground(pool, cache, WINDOW_WIDTH, WINDOW_HEIGHT, reference, 8);
+    auto error = [&](const std::vector<sf::Uint8>& image) {
+        double sum = 0;
+        for (std::size_t i = 0; i < image.size(); i++) sum += std::abs(image[i] - reference[i]);
+        return sum / image.size();
+    };
+    const std::size_t pixels = static_cast<std::size_t>(WINDOW_WIDTH) * WINDOW_HEIGHT;
+    for (int samples : {1, 4, 0}) {
+        std::vector<sf::Uint8> image;
+        LensedRenderStats stats;
+        auto start = std::chrono::steady_clock::now();
+        stats = renderLensedBackground(pool, cache, WINDOW_WIDTH, WINDOW_HEIGHT, image, samples);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "  " << (samples == 0 ? "adaptive" : std::to_string(samples * samples) + " spp uniform") << ": "
+                  << ms << " ms, " << static_cast<double>(stats.samples) / pixels << " samples/px, "
+                  << 100.0 * stats.supersampledPixels / pixels << "% supersampled, mean error "
+                  << error(image) << " vs 64 spp\n";
+    }
+}
+
+void benchmarkMemoryPolicy() {
+    std::cout << "Ray memory policy (128 MiB of trajectory points)\n";
+    WorkerPool pool;
+    MemoryPolicy saved = memoryPolicy();
+    memoryPolicy().firstTouchPool = &pool;
+    const std::size_t count = (std::size_t(128) << 20) / sizeof(Vector2f);
+    
+    auto measure = [&](const char* label) {
+        std::vector<Vector2f, PolicyAllocator<Vector2f>> data(count, Vector2f(1.0f, 2.0f));
+        // Streaming read bandwidth, split over the pool like the ray update
+        auto start = std::chrono::steady_clock::now();
+        std::vector<double> partial(pool.size(), 0.0);
+        for (int pass = 0; pass < 4; pass++) {
+            pool.parallelFor(count, [&](std::size_t begin, std::size_t end, unsigned worker) {
+                float sum = 0;
+                for (std::size_t i = begin; i < end; i++) sum += data[i].x;
+                partial[worker] += sum;
+            });
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double gigabytes = 4.0 * count * sizeof(Vector2f) / 1e9;
+        
+        // Dependent random accesses: dominated by TLB reach
+        std::uint32_t index = 1;
+        const std::size_t probes = 4000000;
+        start = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < probes; i++) {
+            index = index * 1664525u + 1013904223u + static_cast<std::uint32_t>(data[index % count].x);
+        }
+        double randomNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / probes;
+        benchmarkSink = static_cast<float>(partial[0]) + index;
+        std::cout << "  " << label << ": " << gigabytes / seconds << " GB/s streaming, "
+                  << randomNs << " ns per random access\n";
+    };
+    
+    memoryPolicy().transparentHugePages = false;
+    memoryPolicy().hugeTLB = false;
+    memoryPolicy().firstTouch = false;
+    measure("4 KiB pages, main-thread touch");
+    memoryPolicy().transparentHugePages = true;
+    memoryPolicy().firstTouch = true;
+    measure("huge pages, worker first-touch");
+    memoryPolicy() = saved;
+}
+
+void benchmarkMorton() {
+    // A 4096x4096 flux grid is far larger than cache, so scattered deposits miss
+    const std::size_t rays = 262144;
+    const int extent = 4096;
+    std::cout << "Morton ordering (" << rays << " rays depositing into a " << extent << "x" << extent << " grid)\n";
+    FluxAccumulator flux(extent, extent, 1.0f, 1);
+    RayStore store;
+    std::uint32_t seed = 12345;
+    for (std::size_t i = 0; i < rays; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        float x = static_cast<float>(seed % extent);
+        seed = seed * 1664525u + 1013904223u;
+        float y = static_cast<float>(seed % extent);
+        store.emplace(Vector2f(x, y), Vector2f(LIGHT_SPEED, 0.0f), sf::Color::White);
+    }
+    
+    auto depositAll = [&](std::size_t) {
+        FluxWriter writer = flux.writer(0);
+        for (const LightRay& ray : store) writer.deposit(ray.getPosition());
+    };
+    depositAll(rays);  // fault the grid in before timing
+    benchmark("spawn order", rays, depositAll);
+    MortonSorter sorter(1, 1.0f);
+    auto start = std::chrono::steady_clock::now();
+    sorter.computeKeys(store);
+    sorter.sort(store, false);
+    double sortMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    benchmark("Morton order", rays, depositAll);
+    std::cout << "  full sort: " << sortMs << " ms\n";
+}
+
+void benchmarkPartition() {
+    std::cout << "Status partitions (65536 rays, about half absorbed)\n";
+    const std::size_t rays = 65536;
+    const std::size_t steps = 64;
+    const float dt = 1.0f / 60.0f;
+    BlackHole hole(Vector2f(WINDOW_WIDTH / 2.0f, WINDOW_HEIGHT / 2.0f), 50.0f);
+    
+    // A random half of the rays start inside the horizon and are absorbed on
+    // their first step, so the old per-ray branch is unpredictable
+    auto makeRays = [&](auto&& add) {
+        std::uint32_t seed = 7;
+        for (std::size_t i = 0; i < rays; i++) {
+            seed = seed * 1664525u + 1013904223u;
+            Vector2f start = seed >> 31 ? hole.getPosition() : Vector2f(100.0f, 50.0f + (i % 15) * 50.0f);
+            add(start, Vector2f(LIGHT_SPEED, 0.0f), sf::Color::White);
+        }
+    };
+    
+    std::vector<LightRay> mixed;
+    makeRays([&](Vector2f p, Vector2f v, sf::Color c) { mixed.emplace_back(p, v, c); });
+    for (auto& ray : mixed) ray.update(hole, dt);
+    benchmark("status check per ray (previous loop)", rays * steps, [&](std::size_t) {
+        for (std::size_t s = 0; s < steps; s++) {
+            for (auto& ray : mixed) {
+                if (!ray.isAbsorbed()) ray.update(hole, dt);
+            }
+        }
+    });
+    
+    RayStore store;
+    makeRays([&](Vector2f p, Vector2f v, sf::Color c) { store.emplace(p, v, c); });
+    for (auto& ray : store.active()) ray.update(hole, dt);
+    store.partition();
+    benchmark("dense active span + partition pass", rays * steps, [&](std::size_t) {
+        for (std::size_t s = 0; s < steps; s++) {
+            for (auto& ray : store.active()) ray.update(hole, dt);
+            store.partition();
+        }
+    });
+    std::cout << "  " << store.activeCount() << " active, " << store.absorbedCount() << " absorbed at the end\n";
+}
+
+void benchmarkCommandQueue() {
+    std::cout << "Command queue\n";
+    const std::size_t commands = 1 << 22;
+    auto queue = std::make_unique<CommandQueue>();
+    SimulationCommand command{CommandType::SpawnRay, Vector2f(1, 2), Vector2f(LIGHT_SPEED, 0)};
+    SimulationCommand popped;
+    
+    benchmark("push + pop, single thread", commands, [&](std::size_t n) {
+        for (std::size_t i = 0; i < n; i++) {
+            queue->tryPush(command);
+            queue->tryPop(popped);
+        }
+    });
+    
+    // Producers spin on a full ring while the consumer drains; meaningless
+    // without a core per thread
+    unsigned hardwareThreads = std::thread::hardware_concurrency();
+    if (hardwareThreads < 3) {
+        std::cout << "  contended run skipped (needs 3+ hardware threads)\n";
+        benchmarkSink = popped.value;
+        return;
+    }
+    const unsigned producers = std::min(4u, hardwareThreads - 1);
+    benchmark("push, contended producers", commands, [&](std::size_t n) {
+        std::vector<std::thread> threads;
+        for (unsigned t = 0; t < producers; t++) {
+            threads.emplace_back([&, t] {
+                std::size_t share = n / producers + (t < n % producers ? 1 : 0);
+                for (std::size_t i = 0; i < share; i++) {
+                    while (!queue->tryPush(command)) std::this_thread::yield();
+                }
+            });
+        }
+        std::size_t received = 0;
+        while (received < n) {
+            if (queue->tryPop(popped)) received++;
+        }
+        for (auto& thread : threads) thread.join();
+    });
+    benchmarkSink = popped.value;
+    std::cout << "  (" << producers << " producers, ring of 1024)\n";
+}
+
+void benchmarkPathStorage() {
+    std::cout << "Trajectory storage (4096 paths of 1024 points)\n";
+    const std::size_t paths = 4096;
+    const std::size_t points = 1024;
+    
+    auto build = [&](PathStorage storage) {
+        std::vector<RayPath> result;
+        for (std::size_t p = 0; p < paths; p++) {
+            result.emplace_back(storage);
+            float y = 50.0f + (p % 700);
+            for (std::size_t i = 0; i < points; i++) {
+                result.back().push_back(Vector2f(-50.0f + 2.1f * i, y + 40.0f * std::sin(i * 0.01f)));
+            }
+        }
+        return result;
+    };
+    
+    std::vector<Vector2f> scratch;
+    float maxError = 0.0f;
+    std::size_t bytes[2] = {};
+    for (PathStorage storage : {PathStorage::Float, PathStorage::Quantized}) {
+        std::vector<RayPath> stored = build(storage);
+        std::size_t& total = bytes[storage == PathStorage::Quantized];
+        for (const RayPath& path : stored) total += path.bytes();
+        benchmark(storage == PathStorage::Float ? "read float paths" : "decode quantized paths", paths * points,
+                  [&](std::size_t) {
+            float sum = 0;
+            for (const RayPath& path : stored) {
+                Span<const Vector2f> decoded = path.decode(scratch).first;
+                for (const Vector2f& v : decoded) sum += v.x;
+            }
+            benchmarkSink = sum;
+        });
+        if (storage == PathStorage::Quantized) {
+            Span<const Vector2f> decoded = stored[7].decode(scratch).first;
+            for (std::size_t i = 0; i < points; i++) {
+                Vector2f exact(-50.0f + 2.1f * i, 57.0f + 40.0f * std::sin(i * 0.01f));
+                maxError = std::max(maxError, (decoded[i] - exact).magnitude());
+            }
+        }
+    }
+    std::cout << "  bytes per point: " << static_cast<double>(bytes[0]) / (paths * points) << " float, "
+              << static_cast<double>(bytes[1]) / (paths * points) << " quantized (max error "
+              << maxError << " px)\n";
+    
+    // Windowed trails: memory stays fixed however long the ray lives
+    for (PathStorage storage : {PathStorage::Float, PathStorage::Quantized}) {
+        RayPath ring(storage, TrailWindow{256, 0.0f});
+        const std::size_t pushes = 1 << 20;
+        benchmark(storage == PathStorage::Float ? "push into 256-point float ring" : "push into 256-point quantized ring",
+                  pushes, [&](std::size_t) {
+            for (std::size_t i = 0; i < pushes; i++) ring.push_back(Vector2f(2.1f * (i % 1000), 40.0f * std::sin(i * 0.01f)));
+        });
+        std::cout << "  " << ring.bytes() << " bytes after " << pushes << " points\n";
+    }
+}
+
+void benchmarkExport() {
+    const std::size_t frames = 256;
+    const std::size_t rays = 1 << 17;     // 2 MiB of ray state per frame
+    const char* path = "bench_export.tmp";
+    std::cout << "Export I/O (" << frames << " frames of " << rays << " rays, "
+              << frames * rays * 16 / (1 << 20) << " MiB)\n";
+    std::vector<float> state(rays * 4);
+    for (std::size_t i = 0; i < state.size(); i++) state[i] = static_cast<float>(i);
+    const double mebibytes = frames * rays * 16.0 / (1 << 20);
+    
+    // What the simulation thread would spend with a blocking stream
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::ofstream out(path, std::ios::binary);
+        for (std::size_t f = 0; f < frames; f++) {
+            out.write(reinterpret_cast<const char*>(state.data()), state.size() * sizeof(float));
+        }
+    }
+    double blockingSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "  blocking ofstream: " << mebibytes / blockingSeconds << " MiB/s, "
+              << blockingSeconds * 1000.0 / frames << " ms per frame on the caller\n";
+    
+    for (bool uring : {true, false}) {
+        ExportWriter writer(uring);
+        if (uring && writer.getBackend() != ExportWriter::Backend::IoUring) {
+            std::cout << "  io_uring unavailable, skipped\n";
+            continue;
+        }
+        start = std::chrono::steady_clock::now();
+        int file = writer.open(path);
+        double callerSeconds = 0.0;
+        for (std::size_t f = 0; f < frames; f++) {
+            auto frameStart = std::chrono::steady_clock::now();
+            writer.append(file, state.data(), state.size() * sizeof(float));
+            writer.submit();
+            callerSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - frameStart).count();
+        }
+        writer.close(file);
+        writer.flush();
+        double totalSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "  " << writer.backendName() << ": " << mebibytes / totalSeconds << " MiB/s, "
+                  << callerSeconds * 1000.0 / frames << " ms per frame on the caller ("
+                  << writer.getStallSeconds() * 1000.0 / frames << " ms waiting for buffers, "
+                  << writer.getSubmissions() << " submissions)\n";
+    }
+    std::remove(path);
+}
+
+void benchmarkSweep() {
+    const std::size_t scenes = 4096;
+    const std::size_t raysPerScene = 4;
+    const int steps = 240;
+    const float dt = 1.0f / 60.0f;
+    std::cout << "Parameter sweep (" << scenes << " scenes x " << raysPerScene << " rays, " << steps << " steps)\n";
+    
+    std::vector<SweepScene> sweep;
+    for (std::size_t s = 0; s < scenes; s++) {
+        SweepScene scene{Vector2f(WINDOW_WIDTH / 2.0f, WINDOW_HEIGHT / 2.0f), 20.0f + 60.0f * s / scenes, {}};
+        for (std::size_t r = 0; r < raysPerScene; r++) {
+            float y = WINDOW_HEIGHT / 2.0f - 20.0f - 60.0f * r;
+            scene.rays.push_back({Vector2f(-50.0f, y), Vector2f(LIGHT_SPEED, 0.0f), std::abs(y - WINDOW_HEIGHT / 2.0f)});
+        }
+        sweep.push_back(std::move(scene));
+    }
+    
+    // The same sweep one scene at a time through LightRay
+    std::vector<std::vector<LightRay>> reference(scenes);
+    double scalarNs = benchmark("per-scene LightRay::update", scenes * raysPerScene * steps, [&](std::size_t) {
+        for (std::size_t s = 0; s < scenes; s++) {
+            BlackHole hole(sweep[s].holePosition, sweep[s].mass);
+            for (const SweepRay& ray : sweep[s].rays) {
+                reference[s].emplace_back(ray.position, ray.velocity, sf::Color::White, ray.impactParameter);
+            }
+            for (int step = 0; step < steps; step++) {
+                for (LightRay& ray : reference[s]) {
+                    if (!ray.isAbsorbed()) ray.update(hole, dt);
+                }
+            }
+        }
+    });
+    
+    WorkerPool pool(1);
+    SweepBatch batch;
+    double batchNs = benchmark("SweepBatch, one thread", scenes * raysPerScene * steps, [&](std::size_t) {
+        batch.pack(sweep);
+        batch.step(pool, dt, steps);
+        batch.scatter(sweep);
+    });
+    
+    float maxDifference = 0.0f;
+    std::size_t captureMismatches = 0;
+    for (std::size_t s = 0; s < scenes; s++) {
+        for (std::size_t r = 0; r < raysPerScene; r++) {
+            const LightRay& expected = reference[s][r];
+            const SweepRay& actual = sweep[s].rays[r];
+            if (expected.isAbsorbed() != actual.absorbed) {
+                captureMismatches++;
+            } else if (!actual.absorbed) {
+                maxDifference = std::max(maxDifference, (expected.getPosition() - actual.position).magnitude());
+            }
+        }
+    }
+    std::cout << "  speedup: " << scalarNs / batchNs << "x with " << SweepBatch::LANES << "-lane blocks; max drift "
+              << maxDifference << " px, " << captureMismatches << " capture mismatches\n";
+}
+
+void benchmarkFrameEncoder() {
+    const int frames = 24;
+    const char* prefix = "bench_frame_";
+    std::cout << "Frame encoding (" << frames << " lensed frames at " << WINDOW_WIDTH << "x" << WINDOW_HEIGHT << ")\n";
+    
+    // A handful of distinct frames, cycled, so encoding dominates
+    WorkerPool pool;
+    DeflectionCache cache(WINDOW_WIDTH, WINDOW_HEIGHT);
+    std::vector<std::vector<sf::Uint8>> images(8);
+    for (std::size_t i = 0; i < images.size(); i++) {
+        BlackHole hole(Vector2f(WINDOW_WIDTH / 2.0f - 100.0f + 25.0f * i, WINDOW_HEIGHT / 2.0f), 30.0f);
+        cache.update(pool, hole);
+        renderLensedBackground(pool, cache, WINDOW_WIDTH, WINDOW_HEIGHT, images[i]);
+    }
+    
+    unsigned hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (ImageFormat format : {ImageFormat::Qoi, ImageFormat::Png}) {
+        for (unsigned threads : {1u, hardwareThreads}) {
+            ExportWriter writer;
+            double fps, ratio;
+            {
+                FrameEncoder encoder(writer, prefix, format, threads);
+                for (int f = 0; f < frames; f++) {
+                    encoder.submit(images[f % images.size()].data(), WINDOW_WIDTH, WINDOW_HEIGHT);
+                }
+                encoder.flush();
+                fps = encoder.framesPerSecond();
+                ratio = encoder.compressionRatio();
+            }
+            writer.flush();
+            std::cout << "  " << (format == ImageFormat::Png ? "PNG" : "QOI") << ", " << threads << " thread"
+                      << (threads == 1 ? "" : "s") << ": " << fps << " frames/s, " << ratio << ":1\n";
+            if (hardwareThreads == 1) break;
+        }
+    }
+    for (int f = 0; f < frames; f++) {
+        char name[64];
+        std::snprintf(name, sizeof(name), "%s%06d.qoi", prefix, f);
+        std::remove(name);
+        std::snprintf(name, sizeof(name), "%s%06d.png", prefix, f);
+        std::remove(name);
+    }
+}
+
+void benchmarkTrailAccumulation() {
+    const std::size_t trails = 200000;
+    const int points = 32;
+    std::cout << "HDR trail accumulation (" << trails << " trails of " << points << " points, "
+              << WINDOW_WIDTH << "x" << WINDOW_HEIGHT << ")\n";
+    WorkerPool pool;
+    TrailAccumulator accumulator(WINDOW_WIDTH, WINDOW_HEIGHT, 0.05f);
+    std::vector<sf::Uint8> pixels;
+    for (PathStorage storage : {PathStorage::Float, PathStorage::Quantized}) {
+        // Arcs curling around the centre, heavily overlapping
+        std::vector<RayPath> paths;
+        std::vector<sf::Color> colors;
+        paths.reserve(trails);
+        std::uint32_t seed = 12345;
+        auto random = [&]() {
+            seed = seed * 1664525u + 1013904223u;
+            return (seed >> 8) * (1.0f / 16777216.0f);
+        };
+        for (std::size_t t = 0; t < trails; t++) {
+            paths.emplace_back(storage, TrailWindow{});
+            Vector2f position(random() * WINDOW_WIDTH, random() * WINDOW_HEIGHT);
+            float angle = random() * 2.0f * PI;
+            float curl = (random() - 0.5f) * 0.2f;
+            for (int k = 0; k < points; k++) {
+                paths.back().push_back(position);
+                position = position + Vector2f(std::cos(angle), std::sin(angle)) * 2.5f;
+                angle += curl;
+            }
+            colors.emplace_back(static_cast<sf::Uint8>(128 + 127 * random()), static_cast<sf::Uint8>(128 + 127 * random()), 255);
+        }
+        
+        const int frames = 5;
+        double accumulateMs = 0, toneMapMs = 0;
+        for (int f = 0; f < frames; f++) {
+            accumulator.accumulate(pool, trails, [&](std::size_t i) -> const RayPath& { return paths[i]; },
+                                   [&](std::size_t i) { return colors[i]; });
+            accumulator.toneMap(pool, pixels);
+            accumulateMs += accumulator.getLastAccumulateMilliseconds();
+            toneMapMs += accumulator.getLastToneMapMilliseconds();
+        }
+        std::cout << "  " << (storage == PathStorage::Float ? "float" : "quantized") << " paths: "
+                  << accumulateMs / frames << " ms accumulate, " << toneMapMs / frames << " ms tone map, "
+                  << accumulator.getLastSegments() / (accumulateMs / frames) / 1000.0 << " M segments/s on "
+                  << pool.size() << " thread" << (pool.size() == 1 ? "" : "s") << "\n";
+        benchmarkSink = pixels[(WINDOW_HEIGHT / 2 * WINDOW_WIDTH + WINDOW_WIDTH / 2) * 4];
+    }
+}
+
+void runBenchmarks() {
+    benchmarkMath();
+    benchmarkFlux();
+    benchmarkKerr();
+    benchmarkDisk();
+    benchmarkDrag();
+    benchmarkLensedAntialiasing();
+    benchmarkMemoryPolicy();
+    benchmarkMorton();
+    benchmarkPartition();
+    benchmarkCommandQueue();
+    benchmarkPathStorage();
+    benchmarkSweep();
+    benchmarkExport();
+    benchmarkFrameEncoder();
+    benchmarkTrailAccumulation();
+}
+
+#ifndef BLACKHOLE_LIBRARY
+int main(int argc, char* argv[]) {
+    unsigned targetFps = 60;
+    ImageFormat recordFormat = ImageFormat::Qoi;
+    std::string recordPrefix;
+    int headlessFrames = 0;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--huge-pages") memoryPolicy().transparentHugePages = true;
+        if (arg == "--hugetlb") memoryPolicy().hugeTLB = true;
+        if (arg == "--quantized-paths") pathStorage() = PathStorage::Quantized;
+        if (arg.rfind("--trail-points=", 0) == 0) trailWindow().points = static_cast<std::uint32_t>(std::atoi(arg.c_str() + 15));
+        if (arg.rfind("--trail-seconds=", 0) == 0) trailWindow().seconds = std::max(0.0f, static_cast<float>(std::atof(arg.c_str() + 16)));
+        if (arg == "--no-io-uring") ioUringAllowed() = false;
+        if (arg.rfind("--fps=", 0) == 0) targetFps = static_cast<unsigned>(std::atoi(arg.c_str() + 6));
+        if (arg.rfind("--record=", 0) == 0) recordPrefix = arg.substr(9);
+        if (arg == "--record-format=png") recordFormat = ImageFormat::Png;
+        if (arg.rfind("--render-frames=", 0) == 0) headlessFrames = std::atoi(arg.c_str() + 16);
+        if (arg == "--numa") {
+            memoryPolicy().firstTouch = true;
+            memoryPolicy().pinWorkers = true;
+        }
+    }
+    MetricsServer metricsServer;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool listening = true;
+        if (arg.rfind("--metrics-port=", 0) == 0) {
+            listening = metricsServer.listenTcp(static_cast<std::uint16_t>(std::atoi(arg.c_str() + 15)));
+        } else if (arg.rfind("--metrics-socket=", 0) == 0) {
+            listening = metricsServer.listenUnix(arg.substr(17));
+        }
+        if (!listening) std::cout << "Could not start metrics server for " << arg << "\n";
+    }
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--bench") {
+            runBenchmarks();
+            return 0;
+        }
+    }
+    if (headlessFrames > 0) {
+        renderLensedSequence(recordPrefix.empty() ? "frame_" : recordPrefix, recordFormat, headlessFrames);
+        return 0;
+    }
+    
     try {
-        BlackHoleSimulation simulation;
+        BlackHoleSimulation simulation(targetFps);
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg.rfind("--dump-rays=", 0) == 0 && !simulation.startRayDump(arg.substr(12))) {
+                std::cout << "Could not open " << arg.substr(12) << " for ray dumps\n";
+            }
+        }
+        if (!recordPrefix.empty()) simulation.startRecording(recordPrefix, recordFormat);
         simulation.run();
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
@@ -324,4 +6527,5 @@ int main() {
     }
     
     return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,135 @@
+/*
+ * C interface to the 2D black hole physics core.
+ *
+ * Build the core as a shared library with -DBLACKHOLE_LIBRARY, which leaves
+ * out the SFML front end's main(). The core still uses SFML types (ray
+ * colors, pixel buffers), so the build needs the SFML headers and the
+ * library must link against sfml-graphics; no window is ever opened.
+ * Every function can be called through any C FFI (ctypes, cffi, Julia
+ * ccall, ...). Allocation failures are reported through the return value
+ * (NULL, BH_INVALID_RAY, or fewer steps than requested from bh_scene_step).
+ *
+ * Scenes are independent: calls on different scenes may run on different
+ * threads at the same time. Calls on one scene must not overlap.
+ *
+ * Views point straight into the scene's ray storage, so no data is copied.
+ * A view stays valid until the next call that mutates the same scene
+ * (step, spawn, reset, destroy). Element i of a view starts at
+ * (const char*)data + i * stride and is laid out as described by format.
+ */
+#ifndef BLACKHOLE_H
+#define BLACKHOLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32) && defined(BLACKHOLE_LIBRARY)
+#define BH_API __declspec(dllexport)
+#elif defined(__GNUC__)
+#define BH_API __attribute__((visibility("default")))
+#else
+#define BH_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BH_API_VERSION 5
+
+typedef struct bh_scene bh_scene;
+
+/* Element layout of a view */
+typedef enum bh_format {
+    BH_FORMAT_NONE = 0,
+    BH_FORMAT_F32X2 = 1,        /* two 32-bit floats: x, y in pixels */
+    BH_FORMAT_I16X2_FIXED = 2,  /* two int16: offset from the chunk origin in 1/BH_PATH_FIXED_SCALE px */
+    BH_FORMAT_PATH_CHUNK = 3    /* float x, y chunk origin, then uint32 index of its first point */
+} bh_format;
+
+/* Quantized paths: point i of chunk c is origin_c + (qx, qy) / BH_PATH_FIXED_SCALE,
+   where chunk c covers logical points [start_c, start_{c+1}), compared modulo 2^32.
+   Point k of a path has logical index bh_scene_ray_path_first() + k. */
+#define BH_PATH_FIXED_SCALE 16
+
+typedef struct bh_view {
+    const void* data;
+    size_t length;          /* number of elements */
+    size_t stride;          /* bytes between consecutive elements */
+    int32_t format;         /* a bh_format value */
+} bh_view;
+
+/* Rays are stored [active | absorbed]; escaped rays are dropped each step */
+typedef enum bh_ray_set {
+    BH_RAYS_ALL = 0,
+    BH_RAYS_ACTIVE = 1,
+    BH_RAYS_ABSORBED = 2
+} bh_ray_set;
+
+/* Stable ray identifier; stays valid while the ray exists */
+typedef uint64_t bh_ray_handle;
+#define BH_INVALID_RAY ((bh_ray_handle)0xffffffffu)
+
+BH_API uint32_t bh_api_version(void);
+
+/* Optional per-ray accumulators compiled into this build
+   (-DBH_TRACK_SHAPIRO_DELAY=1, -DBH_TRACK_REDSHIFT=1) */
+#define BH_FEATURE_SHAPIRO_DELAY 1u
+#define BH_FEATURE_REDSHIFT 2u
+BH_API uint32_t bh_features(void);
+
+/* threads = 0 uses every hardware thread. Returns NULL on failure. */
+BH_API bh_scene* bh_scene_create(float mass, float spin, unsigned threads);
+BH_API void bh_scene_destroy(bh_scene* scene);
+BH_API void bh_scene_reset(bh_scene* scene);
+
+BH_API void bh_scene_set_hole(bh_scene* scene, float x, float y, float mass, float spin);
+/* kerr != 0 integrates with the Kerr geodesic engine */
+BH_API void bh_scene_set_kerr(bh_scene* scene, int kerr);
+
+/* Returns BH_INVALID_RAY on failure */
+BH_API bh_ray_handle bh_scene_spawn_ray(bh_scene* scene, float x, float y, float vx, float vy);
+/* Returns the number of steps completed. Fewer than steps means a step failed
+   to allocate trajectory memory: the rays it had already moved keep their new
+   state and the remaining steps are skipped. */
+BH_API unsigned bh_scene_step(bh_scene* scene, float dt, unsigned steps);
+
+BH_API size_t bh_scene_ray_count(const bh_scene* scene, bh_ray_set set);
+/* Index of the ray in the views, or -1 once it has been removed */
+BH_API int64_t bh_scene_ray_index(const bh_scene* scene, bh_ray_handle ray);
+BH_API bh_ray_handle bh_scene_ray_handle(const bh_scene* scene, size_t index);
+
+/* Strided views over the ray array, in index order */
+BH_API bh_view bh_scene_positions(const bh_scene* scene, bh_ray_set set);
+BH_API bh_view bh_scene_velocities(const bh_scene* scene, bh_ray_set set);
+/* Recorded trajectory of the ray at index: BH_FORMAT_F32X2 points, or
+   BH_FORMAT_I16X2_FIXED offsets together with the chunk table below.
+   A windowed trail is a ring: this view holds the older points and
+   bh_scene_ray_path_wrapped() the newer ones (empty until it wraps). */
+BH_API bh_view bh_scene_ray_path(const bh_scene* scene, size_t index);
+BH_API bh_view bh_scene_ray_path_wrapped(const bh_scene* scene, size_t index);
+/* Extra arrival time in seconds of the ray at index; 0 without
+   BH_FEATURE_SHAPIRO_DELAY */
+BH_API float bh_scene_ray_shapiro_delay(const bh_scene* scene, size_t index);
+/* Gravitational redshift z of the ray at index relative to where it was
+   spawned; 0 without BH_FEATURE_REDSHIFT */
+BH_API float bh_scene_ray_redshift(const bh_scene* scene, size_t index);
+/* Logical index of the oldest kept point; 0 unless a trail window dropped points */
+BH_API uint64_t bh_scene_ray_path_first(const bh_scene* scene, size_t index);
+/* BH_FORMAT_PATH_CHUNK entries; empty for float paths. The first chunk may
+   start before the oldest kept point. */
+BH_API bh_view bh_scene_ray_path_chunks(const bh_scene* scene, size_t index);
+
+/* Rays spawned into the scene after this call record 16-bit paths if
+   quantized != 0; existing rays keep their storage */
+BH_API void bh_scene_set_path_storage(bh_scene* scene, int quantized);
+/* Rays spawned into the scene after this call keep only the last points
+   points and, if seconds > 0, only points younger than seconds. Both 0
+   keeps whole trajectories; seconds alone sizes the ring for that age. */
+BH_API void bh_scene_set_trail_window(bh_scene* scene, uint32_t points, float seconds);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif